@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "src/PackedDecoding.hpp"
+
+/* Times decodePackedVarInts/decodePackedDoubles against the element by element loops they replaced, on long packed
+   arrays of a few typical shapes. Prints the best of a number of runs of each. */
+
+namespace
+{
+constexpr uint64_t ELEMENT_COUNT{1 << 16};
+constexpr int RUNS{2000};
+
+/* The byte loop ProtobufDecoder::decodeVarInt used to run for every element */
+uint64_t decodeVarIntLoop(const hk::ByteSpan buffer, uint64_t& currentIndex)
+{
+    uint64_t result{0};
+    uint8_t byteCount{0};
+    while (currentIndex < buffer.size())
+    {
+        const uint8_t varintPart = buffer[currentIndex++];
+        result |= (uint64_t)(varintPart & 0b01111111) << (7 * byteCount);
+        ++byteCount;
+        if (!(varintPart & 0b10000000))
+        {
+            break;
+        }
+    }
+    return result;
+}
+
+/* And the one decodeNumber64 used to run for every double */
+uint64_t decodeNumber64Loop(const hk::ByteSpan buffer, uint64_t& currentIndex)
+{
+    uint64_t result{0};
+    for (uint8_t byteCount = 0; byteCount < 8; byteCount++)
+    {
+        result |= (uint64_t)buffer[currentIndex++] << (8 * byteCount);
+    }
+    return result;
+}
+
+std::vector<uint8_t> encodeVarInts(const std::vector<uint64_t>& values)
+{
+    std::vector<uint8_t> bytes;
+    for (uint64_t value : values)
+    {
+        do
+        {
+            uint8_t varintPart = value & 0b01111111;
+            value >>= 7;
+            bytes.push_back(value ? varintPart | 0b10000000 : varintPart);
+        } while (value);
+    }
+    return bytes;
+}
+
+template <typename Function>
+double bestOf(Function&& function)
+{
+    double best{1e9};
+    for (int run = 0; run < RUNS; run++)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void printResult(const char* name, const double before, const double after, const bool matches)
+{
+    printf("%-16s %6.3f ms -> %6.3f ms  (x%.1f)%s\n", name, before, after, before / after,
+        matches ? "" : "  MISMATCH");
+}
+
+void benchVarInts(const char* name, const std::vector<uint64_t>& values)
+{
+    const std::vector<uint8_t> bytes = encodeVarInts(values);
+    const hk::ByteSpan buffer{bytes};
+
+    hk::IntegerVec loopOut;
+    const double before = bestOf(
+        [&]()
+        {
+            /* A new vector every run, like the decoder gets for every field */
+            hk::IntegerVec out;
+            uint64_t currentIndex{0};
+            while (currentIndex < buffer.size())
+            {
+                out.emplace_back(decodeVarIntLoop(buffer, currentIndex));
+            }
+            loopOut = std::move(out);
+        });
+
+    hk::IntegerVec bulkOut;
+    const double after = bestOf(
+        [&]()
+        {
+            hk::IntegerVec out;
+            hk::decodePackedVarInts(buffer, 0, buffer.size(), out);
+            bulkOut = std::move(out);
+        });
+
+    printResult(name, before, after, std::ranges::equal(bulkOut, values) && std::ranges::equal(loopOut, values));
+}
+
+void benchDoubles(std::mt19937_64& random)
+{
+    std::vector<uint8_t> bytes(ELEMENT_COUNT * sizeof(double));
+    std::ranges::generate(bytes, [&]() { return static_cast<uint8_t>(random()); });
+    const hk::ByteSpan buffer{bytes};
+
+    hk::DoubleVec loopOut;
+    const double before = bestOf(
+        [&]()
+        {
+            hk::DoubleVec out;
+            uint64_t currentIndex{0};
+            while (currentIndex < buffer.size())
+            {
+                const uint64_t bits = decodeNumber64Loop(buffer, currentIndex);
+                double value;
+                std::memcpy(&value, &bits, sizeof(value));
+                out.emplace_back(value);
+            }
+            loopOut = std::move(out);
+        });
+
+    hk::DoubleVec bulkOut;
+    const double after = bestOf(
+        [&]()
+        {
+            hk::DoubleVec out;
+            hk::decodePackedDoubles(buffer, 0, buffer.size(), out);
+            bulkOut = std::move(out);
+        });
+
+    const bool matches = bulkOut.size() == loopOut.size() &&
+        !std::memcmp(bulkOut.data(), loopOut.data(), loopOut.size() * sizeof(double));
+    printResult("doubles", before, after, matches);
+}
+} // namespace
+
+int main()
+{
+    std::mt19937_64 random{1};
+    std::vector<uint64_t> values(ELEMENT_COUNT);
+
+    printf("%lu elements per array, best of %d runs, %s kernel\n", ELEMENT_COUNT, RUNS,
+        hk::getPackedVarIntKernelName());
+
+    std::ranges::generate(values, [&]() { return random() % 100; });
+    benchVarInts("values < 128", values);
+
+    std::ranges::generate(values, [&]() { return random() % 10 ? random() % 100 : random() % 100000; });
+    benchVarInts("90% one byte", values);
+
+    std::ranges::generate(values, [&]() { return random() % 2 ? random() % 100 : random() % 100000; });
+    benchVarInts("50% one byte", values);
+
+    std::ranges::generate(values, [&]() { return random() % (1ull << 40); });
+    benchVarInts("40-bit integers", values);
+
+    benchDoubles(random);
+    return 0;
+}
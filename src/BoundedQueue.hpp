@@ -0,0 +1,84 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace utils
+{
+
+/* Blocking FIFO with a fixed capacity, used to hand work over between pipeline stages. Producers block while it's
+   full and consumers block while it's empty, so a slow stage throttles the ones feeding it instead of letting
+   work pile up in memory. Once closed, consumers drain what's left and then get std::nullopt. */
+template <typename T> class BoundedQueue
+{
+public:
+    explicit BoundedQueue(const uint64_t maxSize)
+        : capacity{maxSize}
+    {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    /**
+        @brief Push _item_ waiting for room if needed. Returns false if the queue got closed in the meantime.
+    */
+    bool push(T&& item)
+    {
+        std::unique_lock lock{mutex};
+        notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+        if (closed)
+        {
+            return false;
+        }
+
+        items.emplace_back(std::move(item));
+        lock.unlock();
+        notEmpty.notify_one();
+        return true;
+    }
+
+    /**
+        @brief Pop the oldest item waiting for one if needed. Returns std::nullopt once closed and drained.
+    */
+    std::optional<T> pop()
+    {
+        std::unique_lock lock{mutex};
+        notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+        if (items.empty())
+        {
+            return std::nullopt;
+        }
+
+        std::optional<T> item{std::move(items.front())};
+        items.pop_front();
+        lock.unlock();
+        notFull.notify_one();
+        return item;
+    }
+
+    /**
+        @brief No more items will be pushed. Wakes up everyone waiting.
+    */
+    void close()
+    {
+        {
+            std::scoped_lock lock{mutex};
+            closed = true;
+        }
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+
+private:
+    const uint64_t capacity;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+    bool closed{false};
+};
+
+} // namespace utils
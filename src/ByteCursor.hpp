@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+
+namespace utils
+{
+
+/* Lightweight reader over an in-memory span of bytes (mapped file, inflated frame..). Readers don't check bounds
+   on their own, callers are expected to make sure enough bytes are left using "has" before reading a group of
+   fields. This keeps the per field cost down to a load and a byte swap. */
+class ByteCursor
+{
+public:
+    ByteCursor() = default;
+
+    explicit ByteCursor(std::span<const uint8_t> bytes)
+        : data{bytes}
+    {}
+
+    /**
+        @brief Check if at least _n_ more bytes can be read
+    */
+    bool has(const uint64_t n) const
+    {
+        return data.size() - pos >= n;
+    }
+
+    uint64_t remaining() const
+    {
+        return data.size() - pos;
+    }
+
+    uint64_t position() const
+    {
+        return pos;
+    }
+
+    void skip(const uint64_t n)
+    {
+        pos += n;
+    }
+
+    /**
+        @brief Read 1 byte and return uint8_t
+    */
+    uint8_t read1()
+    {
+        return data[pos++];
+    }
+
+    /**
+        @brief Read 2 big endian bytes and return uint16_t
+    */
+    uint16_t read2()
+    {
+        uint16_t value;
+        std::memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return __builtin_bswap16(value);
+    }
+
+    /**
+        @brief Read 4 big endian bytes and return uint32_t
+    */
+    uint32_t read4()
+    {
+        uint32_t value;
+        std::memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return __builtin_bswap32(value);
+    }
+
+    /**
+        @brief Read 8 big endian bytes and return uint64_t
+    */
+    uint64_t read8()
+    {
+        uint64_t value;
+        std::memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return __builtin_bswap64(value);
+    }
+
+    /**
+        @brief Return a view over the next _n_ bytes without copying them
+    */
+    std::span<const uint8_t> readSpan(const uint64_t n)
+    {
+        std::span<const uint8_t> result = data.subspan(pos, n);
+        pos += n;
+        return result;
+    }
+
+    /**
+        @brief Read N bytes, supposedly ASCII and return the string it forms
+    */
+    std::string readString(const uint64_t n)
+    {
+        std::string result(reinterpret_cast<const char*>(data.data() + pos), n);
+        pos += n;
+        return result;
+    }
+
+    /**
+        @brief Determine if the next 12 bytes form the magic number. Consumes them.
+    */
+    bool isMagicNumberNext()
+    {
+        if (!has(12))
+        {
+            pos = data.size();
+            return false;
+        }
+
+        // Magic hex: e91100a843a0412d94b306da
+        const uint64_t highMagic = read8();
+        const uint32_t lowMagic = read4();
+        return highMagic == 0xe91100a843a0412d && lowMagic == 0x94b306da;
+    }
+
+private:
+    std::span<const uint8_t> data;
+    uint64_t pos{0};
+};
+
+} // namespace utils
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <vector>
+
+#include "Utility.hpp"
+
+namespace utils
+{
+
+/* Cache files (compiled schemas, recording indexes) are written in host byte order. A cache moved to a host of
+   other endianness simply fails its magic number check and gets rebuilt. */
+struct CacheWriter
+{
+    std::vector<uint8_t> bytes;
+
+    template <typename T> void put(const T value)
+    {
+        const uint64_t pos = bytes.size();
+        bytes.resize(pos + sizeof(T));
+        std::memcpy(bytes.data() + pos, &value, sizeof(T));
+    }
+
+    void putString(const std::string_view str)
+    {
+        put<uint32_t>(str.size());
+        bytes.insert(bytes.end(), str.begin(), str.end());
+    }
+};
+
+/* Reads never go past the end, the first one that would clears _ok_ and everything after reads as zero */
+struct CacheReader
+{
+    const uint8_t* data{nullptr};
+    uint64_t size{0};
+    uint64_t pos{0};
+    bool ok{true};
+
+    template <typename T> T get()
+    {
+        T value{};
+        if (!ok || size - pos < sizeof(T))
+        {
+            ok = false;
+            return value;
+        }
+        std::memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return value;
+    }
+
+    std::string getString()
+    {
+        const uint32_t len = get<uint32_t>();
+        if (!ok || size - pos < len)
+        {
+            ok = false;
+            return {};
+        }
+        std::string str(reinterpret_cast<const char*>(data + pos), len);
+        pos += len;
+        return str;
+    }
+};
+
+/**
+    @brief Read the whole file at _path_ into _bytes_
+*/
+inline bool readCacheFile(const std::filesystem::path& path, std::vector<uint8_t>& bytes)
+{
+    std::ifstream in{path, std::ios::binary | std::ios::ate};
+    if (in.fail())
+    {
+        return false;
+    }
+
+    const std::streamoff size = in.tellg();
+    if (size < 0)
+    {
+        return false;
+    }
+
+    bytes.resize(size);
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+    return !in.fail();
+}
+
+/**
+    @brief Write _header_ followed by _payload_ to _path_. Written next to the final file and renamed in place so
+    concurrent readers never see a half written cache.
+*/
+inline bool writeCacheFile(const std::filesystem::path& path, const CacheWriter& header, const CacheWriter& payload)
+{
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+    const std::filesystem::path tmpPath = path.string() + ".tmp" + std::to_string(getpid());
+    std::ofstream out{tmpPath, std::ios::binary};
+    out.write(reinterpret_cast<const char*>(header.bytes.data()), header.bytes.size());
+    out.write(reinterpret_cast<const char*>(payload.bytes.data()), payload.bytes.size());
+    out.close();
+    if (out.fail())
+    {
+        printlne("Failed to write cache file %s", tmpPath.c_str());
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec)
+    {
+        printlne("Failed to move cache file %s in place: %s", path.c_str(), ec.message().c_str());
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
+
+} // namespace utils
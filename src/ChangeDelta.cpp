@@ -0,0 +1,240 @@
+#include "ChangeDelta.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <optional>
+
+#include "Utility.hpp"
+
+namespace hk
+{
+
+namespace
+{
+/* Slots only order the names of a single schema, fields held from another one have to be looked up by name */
+const FieldValue* findValue(const FieldMap& map, const FieldName& name, const bool sameSchema)
+{
+    if (sameSchema)
+    {
+        const auto it = map.find(name);
+        return it != map.end() ? &it->second : nullptr;
+    }
+    const auto it =
+        std::find_if(map.begin(), map.end(), [&name](const auto& field) { return field.first == name.str(); });
+    return it != map.end() ? &it->second : nullptr;
+}
+
+/* Whether _previous_ holds fields _map_ doesn't, these can't be told apart from unchanged ones in a delta */
+bool lostFields(const FieldMap& previous, const FieldMap& map, const bool sameSchema)
+{
+    if (previous.size() > map.size())
+    {
+        return true;
+    }
+    return std::any_of(previous.begin(), previous.end(),
+        [&](const auto& field) { return !findValue(map, field.first, sameSchema); });
+}
+
+bool isString(const FieldValue& value)
+{
+    return std::holds_alternative<std::pmr::string>(value) || std::holds_alternative<std::string_view>(value);
+}
+
+/* Equality of values that aren't maps. Strings compare the same whether copied or viewed, doubles compare by their
+   bits so that a NaN stays unchanged. */
+bool sameValue(const FieldValue& previous, const FieldValue& value)
+{
+    if (isString(previous) || isString(value))
+    {
+        return isString(previous) && isString(value) && GET_STRV(previous) == GET_STRV(value);
+    }
+    if (previous.index() != value.index())
+    {
+        return false;
+    }
+    if (const auto* integer = std::get_if<uint64_t>(&value))
+    {
+        return *integer == std::get<uint64_t>(previous);
+    }
+    if (const auto* real = std::get_if<double>(&value))
+    {
+        return std::bit_cast<uint64_t>(*real) == std::bit_cast<uint64_t>(std::get<double>(previous));
+    }
+    if (const auto* strings = std::get_if<StringVec>(&value))
+    {
+        return *strings == std::get<StringVec>(previous);
+    }
+    if (const auto* integers = std::get_if<IntegerVec>(&value))
+    {
+        return *integers == std::get<IntegerVec>(previous);
+    }
+    if (const auto* reals = std::get_if<DoubleVec>(&value))
+    {
+        return std::equal(reals->begin(), reals->end(), std::get<DoubleVec>(previous).begin(),
+            std::get<DoubleVec>(previous).end(),
+            [](const double a, const double b) { return std::bit_cast<uint64_t>(a) == std::bit_cast<uint64_t>(b); });
+    }
+    /* Maps only get here when they can't be compared field by field */
+    return false;
+}
+
+void diffFields(const FieldMap& previous, const FieldMap& fields, const bool sameSchema, FieldMap& delta);
+
+/* What changed going from _previous_ to _value_, nothing if it didn't change */
+std::optional<FieldValue> diffValue(const FieldValue& previous, const FieldValue& value, const bool sameSchema)
+{
+    const auto* map = std::get_if<FieldMap>(&value);
+    const auto* previousMap = std::get_if<FieldMap>(&previous);
+    if (map && previousMap && !lostFields(*previousMap, *map, sameSchema))
+    {
+        FieldMap delta;
+        diffFields(*previousMap, *map, sameSchema, delta);
+        return delta.empty() ? std::nullopt : std::optional<FieldValue>(std::move(delta));
+    }
+
+    const auto* maps = std::get_if<FieldMapVec>(&value);
+    const auto* previousMaps = std::get_if<FieldMapVec>(&previous);
+    if (maps && previousMaps && maps->size() == previousMaps->size())
+    {
+        FieldMapVec delta(maps->size());
+        bool changed{false};
+        for (uint64_t i = 0; i < maps->size(); i++)
+        {
+            if (lostFields((*previousMaps)[i], (*maps)[i], sameSchema))
+            {
+                delta[i] = (*maps)[i];
+            }
+            else
+            {
+                diffFields((*previousMaps)[i], (*maps)[i], sameSchema, delta[i]);
+            }
+            changed |= !delta[i].empty();
+        }
+        return changed ? std::optional<FieldValue>(std::move(delta)) : std::nullopt;
+    }
+
+    return sameValue(previous, value) ? std::nullopt : std::optional<FieldValue>(value);
+}
+
+/* Put the fields of _fields_ that _previous_ doesn't hold with the same value into _delta_ */
+void diffFields(const FieldMap& previous, const FieldMap& fields, const bool sameSchema, FieldMap& delta)
+{
+    for (const auto& [name, value] : fields)
+    {
+        const FieldValue* previousValue = findValue(previous, name, sameSchema);
+        if (!previousValue)
+        {
+            delta[name] = value;
+            continue;
+        }
+        if (std::optional<FieldValue> changed = diffValue(*previousValue, value, sameSchema))
+        {
+            delta[name] = std::move(*changed);
+        }
+    }
+}
+} // namespace
+
+ChangeDelta::ChangeDelta(ChangeData::Visitor& visitor)
+    : output{visitor}
+{}
+
+uint64_t ChangeDelta::getRepeatedPayloads() const
+{
+    return repeatedPayloads;
+}
+
+void ChangeDelta::onHeader(const ChangeData::Header& header)
+{
+    output.onHeader(header);
+}
+
+void ChangeDelta::onMeta(const ChangeData::Frame& frame)
+{
+    output.onMeta(frame);
+}
+
+void ChangeDelta::onReset(const ChangeData::Frame& frame)
+{
+    /* Whatever comes next is new again */
+    state.onReset(frame);
+    lastPayloads.clear();
+    output.onReset(frame);
+}
+
+void ChangeDelta::onFrame(ChangeData::Frame& frame)
+{
+    /* Changes are only handed over as const up to here, so the whole frame gets cut down and passed on at once */
+    for (auto& changeSet : frame.changeSetData)
+    {
+        state.onChangeSet(frame, changeSet);
+        std::erase_if(changeSet.changes,
+            [&](ChangeData::SingleChange& change) { return !cutToDelta(frame, changeSet, change); });
+    }
+    std::erase_if(frame.changeSetData,
+        [](const ChangeData::ChangeSetData& changeSet) { return changeSet.changes.empty(); });
+
+    for (const auto& changeSet : frame.changeSetData)
+    {
+        output.onChangeSet(frame, changeSet);
+        for (const auto& change : changeSet.changes)
+        {
+            output.onChange(changeSet, change);
+        }
+    }
+    output.onFrame(frame);
+}
+
+bool ChangeDelta::cutToDelta(const ChangeData::Frame& frame, const ChangeData::ChangeSetData& changeSet,
+    ChangeData::SingleChange& change)
+{
+    if (change.type == ChangeData::ChangeType::DELETED)
+    {
+        lastPayloads.erase(change.name);
+        state.onChange(changeSet, change);
+        return true;
+    }
+    if (change.type != ChangeData::ChangeType::CREATE_UPDATE)
+    {
+        return true;
+    }
+
+    /* Same bytes decoded with the same schema give the same fields, nothing to compare */
+    const uint64_t hash = utils::hashBytes(change.payload.data(), change.payload.size());
+    const auto [payloadIt, created] = lastPayloads.try_emplace(change.name);
+    LastPayload& last = payloadIt->second;
+    if (!created && last.hash == hash && last.schema == frame.metaSchema &&
+        std::ranges::equal(last.bytes, change.payload))
+    {
+        repeatedPayloads++;
+        return false;
+    }
+    last.hash = hash;
+    last.schema = frame.metaSchema;
+    last.bytes.assign(change.payload.begin(), change.payload.end());
+
+    const auto objectIt = state.getObjects().find(change.name);
+    if (created || objectIt == state.getObjects().end())
+    {
+        state.onChange(changeSet, change);
+        return true;
+    }
+
+    FieldMap delta;
+    diffFields(objectIt->second.fields, change.getFields(), objectIt->second.nameOwner == frame.metaSchema, delta);
+    state.onChange(changeSet, change);
+    if (!change.sharedFields)
+    {
+        change.fields = std::move(delta);
+        return !change.fields.empty();
+    }
+
+    /* Zero-copy strings of a cached tree point into the cache entry, the delta keeps the tree alive along with it */
+    const bool changed = !delta.empty();
+    const auto owner = std::make_shared<std::pair<std::shared_ptr<const FieldMap>, FieldMap>>(
+        std::move(change.sharedFields), std::move(delta));
+    change.sharedFields = std::shared_ptr<const FieldMap>(owner, &owner->second);
+    return changed;
+}
+
+} // namespace hk
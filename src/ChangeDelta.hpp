@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "RedactedDecoder.hpp"
+#include "StateEngine.hpp"
+
+namespace hk
+{
+
+/* Hands the recording over to another visitor with every CREATE_UPDATE cut down to the fields it actually changes.
+   The last known fields of every object are kept in a StateEngine, the changes get compared against them: fields
+   not there yet or holding another value stay, nested maps only keep their changed fields and nested map arrays of
+   unchanged length keep their positions, unchanged elements left empty. A payload byte for byte the same as the
+   previous one of its object isn't compared at all. Changes left without fields and change sets left without
+   changes are dropped, the first CREATE_UPDATE of an object always stays whole. */
+class ChangeDelta : public ChangeData::Visitor
+{
+public:
+    explicit ChangeDelta(ChangeData::Visitor& visitor);
+
+    /**
+        @brief Number of CREATE_UPDATE payloads dropped for being the same as the previous one of their object
+    */
+    uint64_t getRepeatedPayloads() const;
+
+    void onHeader(const ChangeData::Header& header) override;
+    void onMeta(const ChangeData::Frame& frame) override;
+    void onReset(const ChangeData::Frame& frame) override;
+    void onFrame(ChangeData::Frame& frame) override;
+
+private:
+    /**
+        @brief Replace the fields of _change_ with the ones it changes, false if the change can be dropped
+    */
+    bool cutToDelta(const ChangeData::Frame& frame, const ChangeData::ChangeSetData& changeSet,
+        ChangeData::SingleChange& change);
+
+private:
+    /* Last payload of an object. The hash only saves comparing the bytes of payloads that differ, the schema is held
+       so that a newer one can't turn up at the same address. */
+    struct LastPayload
+    {
+        uint64_t hash{0};
+        std::shared_ptr<const MetaSchema> schema;
+        std::vector<uint8_t> bytes;
+    };
+
+    ChangeData::Visitor& output;
+    StateEngine state;
+    std::unordered_map<std::string, LastPayload> lastPayloads;
+    uint64_t repeatedPayloads{0};
+};
+
+} // namespace hk
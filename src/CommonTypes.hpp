@@ -1,8 +1,14 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <span>
+#include <stdexcept>
 #include <string>
-#include <unordered_map>
+#include <string_view>
+#include <utility>
 #include <variant>
 #include <vector>
 
@@ -10,7 +16,14 @@ namespace hk
 {
 
 #define GET_MAP(x) std::get<hk::FieldMap>(x)
-#define GET_STR(x) (std::holds_alternative<std::string>(x) ? std::get<std::string>(x) : std::string())
+#define GET_STR(x)                                                                                                     \
+    (std::holds_alternative<std::pmr::string>(x)   ? std::string(std::get<std::pmr::string>(x))                        \
+        : std::holds_alternative<std::string_view>(x) ? std::string(std::get<std::string_view>(x))                     \
+                                                      : std::string())
+#define GET_STRV(x)                                                                                                    \
+    (std::holds_alternative<std::pmr::string>(x)   ? std::string_view(std::get<std::pmr::string>(x))                   \
+        : std::holds_alternative<std::string_view>(x) ? std::get<std::string_view>(x)                                  \
+                                                      : std::string_view())
 #define GET_INT(x) (std::holds_alternative<uint64_t>(x) ? std::get<uint64_t>(x) : -1)
 #define GET_DBL(x) (std::holds_alternative<double>(x) ? std::get<double>(x) : -1)
 #define HOLDS_MAP(x) (std::holds_alternative<hk::FieldMap>(x) ? true : false)
@@ -18,13 +31,234 @@ namespace hk
 
 class FieldMap;
 
-using StringVec = std::vector<std::string>;
-using IntegerVec = std::vector<uint64_t>;
-using DoubleVec = std::vector<double>;
-using FieldMapVec = std::vector<FieldMap>;
-using FieldValue = std::variant<uint64_t, double, std::string, StringVec, IntegerVec, DoubleVec, FieldMap, FieldMapVec>;
+using ByteSpan = std::span<const uint8_t>;
 
-class FieldMap : public std::unordered_map<std::string, FieldValue>
-{};
+/* Decoded containers are std::pmr ones so that a whole decoded frame can be allocated out of one arena. Outside of
+   arena mode they simply use the default (new/delete) resource. */
+using StringVec = std::pmr::vector<std::pmr::string>;
+using IntegerVec = std::pmr::vector<uint64_t>;
+using DoubleVec = std::pmr::vector<double>;
+using FieldMapVec = std::pmr::vector<FieldMap>;
+/* std::string_view only shows up when decoding in zero-copy mode. It points into the frame buffer (or the meta
+   schema for enum names) and stays valid for as long as the owning frame is alive. */
+using FieldValue = std::variant<uint64_t,
+    double,
+    std::pmr::string,
+    StringVec,
+    IntegerVec,
+    DoubleVec,
+    FieldMap,
+    FieldMapVec,
+    std::string_view>;
+
+/* Name of a decoded field. Points to the name interned by the meta schema the field was decoded with, together with
+   the slot the schema gave that name inside its message, so comparing two names never touches the characters. */
+class FieldName
+{
+public:
+    FieldName() = default;
+
+    FieldName(const std::string& internedName, const uint32_t nameSlot)
+        : name{&internedName}
+        , slot{nameSlot}
+    {}
+
+    const std::string& str() const
+    {
+        static const std::string noName;
+        return name ? *name : noName;
+    }
+
+    const char* c_str() const
+    {
+        return str().c_str();
+    }
+
+    bool empty() const
+    {
+        return !name;
+    }
+
+    uint32_t getSlot() const
+    {
+        return slot;
+    }
+
+    bool operator==(const std::string_view other) const
+    {
+        return str() == other;
+    }
+
+private:
+    const std::string* name{nullptr};
+    uint32_t slot{0};
+};
+
+/* Decoded message. Fields sit in a small contiguous array kept sorted by schema slot instead of a hash table with a
+   string key per field. Names point into the meta schema, so FieldMaps must not outlive the schema they were
+   decoded with (frames keep theirs alive). */
+class FieldMap
+{
+public:
+    using value_type = std::pair<FieldName, FieldValue>;
+    using iterator = std::pmr::vector<value_type>::iterator;
+    using const_iterator = std::pmr::vector<value_type>::const_iterator;
+    using allocator_type = std::pmr::polymorphic_allocator<value_type>;
+
+    FieldMap() = default;
+    FieldMap(const FieldMap&) = default;
+    FieldMap(FieldMap&&) = default;
+    FieldMap& operator=(const FieldMap&) = default;
+
+    explicit FieldMap(const allocator_type& allocator)
+        : fields{allocator}
+    {}
+
+    FieldMap(const FieldMap& other, const allocator_type& allocator)
+        : fields{other.fields, allocator}
+    {}
+
+    FieldMap(FieldMap&& other, const allocator_type& allocator)
+        : fields{std::move(other.fields), allocator}
+    {}
+
+    /**
+        @brief Take over the fields of _other_ together with the memory resource they live in. Decoded maps get
+        moved into maps created elsewhere (result slots, changes..), this way they never get copied over.
+    */
+    FieldMap& operator=(FieldMap&& other) noexcept
+    {
+        if (this != &other)
+        {
+            std::destroy_at(&fields);
+            std::construct_at(&fields, std::move(other.fields));
+        }
+        return *this;
+    }
+
+    allocator_type get_allocator() const
+    {
+        return fields.get_allocator();
+    }
+
+    iterator begin()
+    {
+        return fields.begin();
+    }
+
+    iterator end()
+    {
+        return fields.end();
+    }
+
+    const_iterator begin() const
+    {
+        return fields.begin();
+    }
+
+    const_iterator end() const
+    {
+        return fields.end();
+    }
+
+    uint64_t size() const
+    {
+        return fields.size();
+    }
+
+    bool empty() const
+    {
+        return fields.empty();
+    }
+
+    /**
+        @brief Get the value of field _name_, adding an empty one if not there yet. Fields mostly come in slot order
+        so this is an append most of the time.
+    */
+    FieldValue& operator[](const FieldName& name)
+    {
+        if (!fields.empty() && fields.back().first.getSlot() < name.getSlot())
+        {
+            return fields.emplace_back(name, FieldValue{}).second;
+        }
+
+        const auto it = std::lower_bound(fields.begin(), fields.end(), name.getSlot(), compareSlot);
+        if (it != fields.end() && it->first.getSlot() == name.getSlot())
+        {
+            return it->second;
+        }
+        return fields.emplace(it, name, FieldValue{})->second;
+    }
+
+    /**
+        @brief Find field _name_ by its slot, only meaningful for names of the schema this map was decoded with
+    */
+    const_iterator find(const FieldName& name) const
+    {
+        const auto it = std::lower_bound(fields.begin(), fields.end(), name.getSlot(), compareSlot);
+        return it != fields.end() && it->first.getSlot() == name.getSlot() ? it : fields.end();
+    }
+
+    bool contains(const FieldName& name) const
+    {
+        return find(name) != fields.end();
+    }
+
+    /**
+        @brief Lookups by plain name compare strings, which is fine for the handful of fields a message has
+    */
+    iterator find(const std::string_view name)
+    {
+        return std::find_if(fields.begin(), fields.end(), [name](const value_type& f) { return f.first == name; });
+    }
+
+    const_iterator find(const std::string_view name) const
+    {
+        return std::find_if(fields.begin(), fields.end(), [name](const value_type& f) { return f.first == name; });
+    }
+
+    bool contains(const std::string_view name) const
+    {
+        return find(name) != fields.end();
+    }
+
+    /**
+        @brief Get the value of field _name_. Unlike std::unordered_map a missing field isn't added (there's no schema
+        to take its name from), std::out_of_range is thrown instead. Check with HAS_FIELD first.
+    */
+    FieldValue& operator[](const std::string_view name)
+    {
+        const auto it = find(name);
+        if (it == fields.end())
+        {
+            throw std::out_of_range("FieldMap has no field named " + std::string(name));
+        }
+        return it->second;
+    }
+
+    const FieldValue& operator[](const std::string_view name) const
+    {
+        const auto it = find(name);
+        if (it == fields.end())
+        {
+            throw std::out_of_range("FieldMap has no field named " + std::string(name));
+        }
+        return it->second;
+    }
+
+    const FieldValue& at(const std::string_view name) const
+    {
+        return (*this)[name];
+    }
+
+private:
+    static bool compareSlot(const value_type& field, const uint32_t slot)
+    {
+        return field.first.getSlot() < slot;
+    }
+
+private:
+    std::pmr::vector<value_type> fields;
+};
 
 } // namespace hk
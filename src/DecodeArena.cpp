@@ -0,0 +1,93 @@
+#include "DecodeArena.hpp"
+
+#include <atomic>
+
+namespace hk
+{
+namespace
+{
+std::atomic<uint64_t> nextArenaId{1};
+
+/* Arena the current thread allocated from last, saves the lookup while a thread keeps decoding the same frame */
+struct LastUsedArena
+{
+    uint64_t arenaId{0};
+    void* threadArena{nullptr};
+};
+thread_local LastUsedArena lastUsed;
+} // namespace
+
+DecodeArena::DecodeArena()
+    : id{nextArenaId.fetch_add(1)}
+{}
+
+uint64_t DecodeArena::getAllocationCount() const
+{
+    std::scoped_lock lock{mutex};
+    uint64_t count{0};
+    for (const auto& threadArena : threadArenas)
+    {
+        count += threadArena.allocationCount;
+    }
+    return count;
+}
+
+uint64_t DecodeArena::getAllocatedBytes() const
+{
+    std::scoped_lock lock{mutex};
+    uint64_t bytes{0};
+    for (const auto& threadArena : threadArenas)
+    {
+        bytes += threadArena.allocatedBytes;
+    }
+    return bytes;
+}
+
+void* DecodeArena::do_allocate(std::size_t bytes, std::size_t alignment)
+{
+    ThreadArena& threadArena = getThreadArena();
+    threadArena.allocationCount++;
+    threadArena.allocatedBytes += bytes;
+    return threadArena.resource.allocate(bytes, alignment);
+}
+
+void DecodeArena::do_deallocate(void*, std::size_t, std::size_t)
+{
+    /* Released along with the whole arena */
+}
+
+bool DecodeArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept
+{
+    return this == &other;
+}
+
+DecodeArena::ThreadArena& DecodeArena::getThreadArena()
+{
+    if (lastUsed.arenaId == id)
+    {
+        return *static_cast<ThreadArena*>(lastUsed.threadArena);
+    }
+
+    /* Threads hop between frames as they pick up work, a handful of arenas per frame at most */
+    std::scoped_lock lock{mutex};
+    const std::thread::id self = std::this_thread::get_id();
+    ThreadArena* found{nullptr};
+    for (auto& threadArena : threadArenas)
+    {
+        if (threadArena.owner == self)
+        {
+            found = &threadArena;
+            break;
+        }
+    }
+    if (!found)
+    {
+        found = &threadArenas.emplace_back();
+        found->owner = self;
+    }
+
+    lastUsed = {.arenaId = id, .threadArena = found};
+    return *found;
+}
+
+} // namespace hk
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
+
+namespace hk
+{
+
+/* Monotonic memory resource owning everything decoded out of one frame. Several threads decode a frame at once, so
+   each of them bump allocates out of a monotonic buffer of its own and never takes a lock past the first allocation.
+   Deallocation does nothing, the memory goes back in one go when the arena gets destroyed. */
+class DecodeArena : public std::pmr::memory_resource
+{
+public:
+    DecodeArena();
+
+    DecodeArena(const DecodeArena&) = delete;
+    DecodeArena& operator=(const DecodeArena&) = delete;
+
+    /**
+        @brief Number of allocations served so far. Not to be called while decoding.
+    */
+    uint64_t getAllocationCount() const;
+
+    /**
+        @brief Number of bytes handed out so far. Not to be called while decoding.
+    */
+    uint64_t getAllocatedBytes() const;
+
+private:
+    struct ThreadArena
+    {
+        std::thread::id owner;
+        std::pmr::monotonic_buffer_resource resource{INITIAL_BLOCK_BYTES};
+        uint64_t allocationCount{0};
+        uint64_t allocatedBytes{0};
+    };
+
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override;
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment) override;
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override;
+
+    ThreadArena& getThreadArena();
+
+private:
+    static constexpr uint64_t INITIAL_BLOCK_BYTES{64 * 1024};
+
+    /* Tells arenas apart even when a new one lands at the address of a destroyed one */
+    const uint64_t id;
+    mutable std::mutex mutex;
+    /* Deque so the arenas stay put as threads get added */
+    std::deque<ThreadArena> threadArenas;
+};
+
+} // namespace hk
@@ -0,0 +1,119 @@
+#include "DecodeCache.hpp"
+
+#include <algorithm>
+
+#include "Utility.hpp"
+
+namespace hk
+{
+
+DecodeCache::DecodeCache(const uint64_t cacheCapacity)
+    : capacity{cacheCapacity}
+    , shardCapacity{std::max<uint64_t>(1, (cacheCapacity + SHARD_COUNT - 1) / SHARD_COUNT)}
+{}
+
+uint64_t DecodeCache::makeKey(const MetaSchema* schema, const std::string& className, const ByteSpan payload)
+{
+    const uint64_t classHash = utils::hashBytes(reinterpret_cast<const uint8_t*>(className.data()), className.size(),
+        reinterpret_cast<uintptr_t>(schema));
+    return utils::hashBytes(payload.data(), payload.size(), classHash);
+}
+
+std::shared_ptr<const FieldMap> DecodeCache::find(const uint64_t key,
+    const MetaSchema* schema,
+    const std::string& className,
+    const ByteSpan payload)
+{
+    Shard& shard = getShard(key);
+    std::scoped_lock lock{shard.mutex};
+    const auto it = shard.byKey.find(key);
+    if (it == shard.byKey.end() || !matches(**it->second, schema, className, payload))
+    {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+    hits.fetch_add(1, std::memory_order_relaxed);
+    /* Shares ownership of the whole entry, schema and payload included */
+    const std::shared_ptr<const Entry>& entry = *it->second;
+    return std::shared_ptr<const FieldMap>(entry, &entry->fields);
+}
+
+std::shared_ptr<const FieldMap> DecodeCache::insert(const uint64_t key,
+    const std::shared_ptr<const MetaSchema>& schema,
+    const std::string& className,
+    std::vector<uint8_t>&& payload,
+    FieldMap&& fields)
+{
+    auto entry = std::make_shared<Entry>();
+    entry->key = key;
+    entry->schema = schema;
+    entry->className = className;
+    entry->payload = std::move(payload);
+    entry->fields = std::move(fields);
+
+    Shard& shard = getShard(key);
+    std::scoped_lock lock{shard.mutex};
+    if (const auto it = shard.byKey.find(key); it != shard.byKey.end())
+    {
+        const std::shared_ptr<const Entry>& cached = *it->second;
+        if (matches(*cached, schema.get(), className, entry->payload))
+        {
+            return std::shared_ptr<const FieldMap>(cached, &cached->fields);
+        }
+
+        /* Colliding payload, the newer one takes the slot */
+        shard.entries.erase(it->second);
+        shard.byKey.erase(it);
+    }
+
+    shard.entries.emplace_front(entry);
+    shard.byKey.emplace(key, shard.entries.begin());
+    while (shard.entries.size() > shardCapacity)
+    {
+        shard.byKey.erase(shard.entries.back()->key);
+        shard.entries.pop_back();
+    }
+    return std::shared_ptr<const FieldMap>(entry, &entry->fields);
+}
+
+void DecodeCache::clear()
+{
+    for (Shard& shard : shards)
+    {
+        std::scoped_lock lock{shard.mutex};
+        shard.byKey.clear();
+        shard.entries.clear();
+    }
+}
+
+uint64_t DecodeCache::getCapacity() const
+{
+    return capacity;
+}
+
+uint64_t DecodeCache::getHits() const
+{
+    return hits.load(std::memory_order_relaxed);
+}
+
+uint64_t DecodeCache::getMisses() const
+{
+    return misses.load(std::memory_order_relaxed);
+}
+
+bool DecodeCache::matches(const Entry& entry, const MetaSchema* schema, const std::string& className,
+    const ByteSpan payload)
+{
+    return entry.schema.get() == schema && entry.className == className &&
+           std::equal(entry.payload.begin(), entry.payload.end(), payload.begin(), payload.end());
+}
+
+DecodeCache::Shard& DecodeCache::getShard(const uint64_t key)
+{
+    /* Low bits pick the bucket within a shard's map, keep them out of the shard pick */
+    return shards[key >> 60];
+}
+
+} // namespace hk
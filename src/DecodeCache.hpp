@@ -0,0 +1,104 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "CommonTypes.hpp"
+#include "MetaSchema.hpp"
+
+namespace hk
+{
+
+/* Decoded payloads kept around for the next payload with the same bytes, periodic updates send the very same object
+   over and over again. Entries are keyed by a hash of the schema, class name and payload bytes and hand out a single
+   immutable tree shared by every payload it was found for. Decode workers use it concurrently, so entries are split
+   into shards each with a lock of its own, every shard dropping its least recently used entries past its share of
+   the capacity. */
+class DecodeCache
+{
+public:
+    /**
+        @brief Keep at most _cacheCapacity_ decoded payloads
+    */
+    explicit DecodeCache(const uint64_t cacheCapacity);
+
+    DecodeCache(const DecodeCache&) = delete;
+    DecodeCache& operator=(const DecodeCache&) = delete;
+
+    /**
+        @brief Key of _payload_ decoded as an object of class _className_ with _schema_
+    */
+    static uint64_t makeKey(const MetaSchema* schema, const std::string& className, const ByteSpan payload);
+
+    /**
+        @brief Tree decoded out of the same bytes as _payload_ for the same class and schema, nullptr if not cached
+    */
+    std::shared_ptr<const FieldMap> find(const uint64_t key,
+        const MetaSchema* schema,
+        const std::string& className,
+        const ByteSpan payload);
+
+    /**
+        @brief Cache _fields_ decoded out of _payload_ and get them back shared. The entry takes _payload_ over, so
+        zero-copy strings decoded out of it stay valid without holding on to the frame it came from. Field names
+        point into _schema_, which the entry keeps alive. If the payload got cached meanwhile, that tree is returned
+        instead.
+    */
+    std::shared_ptr<const FieldMap> insert(const uint64_t key,
+        const std::shared_ptr<const MetaSchema>& schema,
+        const std::string& className,
+        std::vector<uint8_t>&& payload,
+        FieldMap&& fields);
+
+    /**
+        @brief Drop every entry, trees still in use stay valid
+    */
+    void clear();
+
+    uint64_t getCapacity() const;
+    uint64_t getHits() const;
+    uint64_t getMisses() const;
+
+private:
+    struct Entry
+    {
+        uint64_t key{0};
+        std::shared_ptr<const MetaSchema> schema;
+        std::string className;
+        /* Own copy, tells payloads apart when their hashes collide and holds what zero-copy strings point into */
+        std::vector<uint8_t> payload;
+        FieldMap fields;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        /* Most recently used first */
+        std::list<std::shared_ptr<const Entry>> entries;
+        std::unordered_map<uint64_t, std::list<std::shared_ptr<const Entry>>::iterator> byKey;
+    };
+
+    static bool matches(const Entry& entry, const MetaSchema* schema, const std::string& className,
+        const ByteSpan payload);
+
+    Shard& getShard(const uint64_t key);
+
+private:
+    /* Picked by the top 4 bits of the key */
+    static constexpr uint64_t SHARD_COUNT{16};
+
+    const uint64_t capacity;
+    const uint64_t shardCapacity;
+    std::array<Shard, SHARD_COUNT> shards;
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+};
+
+} // namespace hk
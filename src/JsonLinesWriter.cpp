@@ -0,0 +1,480 @@
+#include "JsonLinesWriter.hpp"
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <climits>
+#include <string_view>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "Utility.hpp"
+
+namespace hk
+{
+
+namespace
+{
+void appendUnsigned(std::string& out, const uint64_t value)
+{
+    char digits[20];
+    const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, end);
+}
+
+/* Shortest representation that reads back the same, JSON has no NaN or infinity */
+void appendDouble(std::string& out, const double value)
+{
+    if (!std::isfinite(value))
+    {
+        out += "null";
+        return;
+    }
+    char digits[32];
+    const auto [end, ec] = std::to_chars(digits, digits + sizeof(digits), value);
+    out.append(digits, end);
+}
+
+/* _value_ zero padded to _width_ digits */
+void appendPadded(std::string& out, uint64_t value, const uint32_t width)
+{
+    char digits[20];
+    for (uint32_t i = width; i > 0; i--)
+    {
+        digits[i - 1] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    out.append(digits, width);
+}
+
+/* Length of the UTF-8 sequence starting at _value_[_index_], 0 if it isn't a valid one. Overlong forms, surrogates
+   and code points past U+10FFFF are invalid too. */
+uint64_t getUtf8Length(const std::string_view value, const uint64_t index)
+{
+    const auto byteAt = [&value](const uint64_t i) { return static_cast<uint8_t>(value[i]); };
+    const uint8_t lead = byteAt(index);
+    uint64_t length{0};
+    uint8_t secondMin{0x80};
+    uint8_t secondMax{0xbf};
+    if (lead >= 0xc2 && lead <= 0xdf)
+    {
+        length = 2;
+    }
+    else if (lead >= 0xe0 && lead <= 0xef)
+    {
+        length = 3;
+        secondMin = lead == 0xe0 ? 0xa0 : 0x80;
+        secondMax = lead == 0xed ? 0x9f : 0xbf;
+    }
+    else if (lead >= 0xf0 && lead <= 0xf4)
+    {
+        length = 4;
+        secondMin = lead == 0xf0 ? 0x90 : 0x80;
+        secondMax = lead == 0xf4 ? 0x8f : 0xbf;
+    }
+    if (!length || value.size() - index < length || byteAt(index + 1) < secondMin || byteAt(index + 1) > secondMax)
+    {
+        return 0;
+    }
+    for (uint64_t i = index + 2; i < index + length; i++)
+    {
+        if ((byteAt(i) & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+    }
+    return length;
+}
+
+void appendString(std::string& out, const std::string_view value)
+{
+    static constexpr char HEX[] = "0123456789abcdef";
+
+    out += '"';
+    /* Copy runs of plain characters and valid UTF-8 in one go. Quotes, backslashes and control characters get
+       escaped, so do bytes not forming valid UTF-8 which end up as the code point of the same value. */
+    uint64_t runStart{0};
+    for (uint64_t i = 0; i < value.size(); i++)
+    {
+        const auto ch = static_cast<uint8_t>(value[i]);
+        if (ch >= 0x20 && ch < 0x80 && ch != '"' && ch != '\\')
+        {
+            continue;
+        }
+        if (ch >= 0x80)
+        {
+            if (const uint64_t length = getUtf8Length(value, i))
+            {
+                i += length - 1;
+                continue;
+            }
+        }
+
+        out.append(value.data() + runStart, i - runStart);
+        runStart = i + 1;
+        switch (ch)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            out += "\\u00";
+            out += HEX[ch >> 4];
+            out += HEX[ch & 0xf];
+            break;
+        }
+    }
+    out.append(value.data() + runStart, value.size() - runStart);
+    out += '"';
+}
+
+/* ISO 8601 UTC time of epoch milliseconds _timeMs_: 2023-11-14T22:14:16.250Z */
+void appendTime(std::string& out, const uint64_t timeMs)
+{
+    const std::chrono::sys_time<std::chrono::milliseconds> time{std::chrono::milliseconds(timeMs)};
+    const std::chrono::sys_days day = std::chrono::floor<std::chrono::days>(time);
+    const std::chrono::year_month_day date{day};
+    const uint64_t dayMs = (time - day).count();
+
+    out += '"';
+    appendPadded(out, static_cast<int32_t>(date.year()), 4);
+    out += '-';
+    appendPadded(out, static_cast<uint32_t>(date.month()), 2);
+    out += '-';
+    appendPadded(out, static_cast<uint32_t>(date.day()), 2);
+    out += 'T';
+    appendPadded(out, dayMs / 3600000, 2);
+    out += ':';
+    appendPadded(out, dayMs / 60000 % 60, 2);
+    out += ':';
+    appendPadded(out, dayMs / 1000 % 60, 2);
+    out += '.';
+    appendPadded(out, dayMs % 1000, 3);
+    out += "Z\"";
+}
+
+void appendFields(std::string& out, const FieldMap& fields);
+
+void appendValue(std::string& out, const FieldValue& value)
+{
+    if (const auto* integer = std::get_if<uint64_t>(&value))
+    {
+        appendUnsigned(out, *integer);
+    }
+    else if (const auto* real = std::get_if<double>(&value))
+    {
+        appendDouble(out, *real);
+    }
+    else if (const auto* string = std::get_if<std::pmr::string>(&value))
+    {
+        appendString(out, *string);
+    }
+    else if (const auto* view = std::get_if<std::string_view>(&value))
+    {
+        appendString(out, *view);
+    }
+    else if (const auto* map = std::get_if<FieldMap>(&value))
+    {
+        appendFields(out, *map);
+    }
+    else
+    {
+        /* Every other alternative is an array */
+        out += '[';
+        bool first{true};
+        const auto appendElement = [&out, &first](const auto& element, const auto& append)
+        {
+            if (!first)
+            {
+                out += ',';
+            }
+            first = false;
+            append(out, element);
+        };
+        if (const auto* strings = std::get_if<StringVec>(&value))
+        {
+            for (const auto& element : *strings)
+            {
+                appendElement(std::string_view(element), appendString);
+            }
+        }
+        else if (const auto* integers = std::get_if<IntegerVec>(&value))
+        {
+            for (const uint64_t element : *integers)
+            {
+                appendElement(element, appendUnsigned);
+            }
+        }
+        else if (const auto* reals = std::get_if<DoubleVec>(&value))
+        {
+            for (const double element : *reals)
+            {
+                appendElement(element, appendDouble);
+            }
+        }
+        else if (const auto* maps = std::get_if<FieldMapVec>(&value))
+        {
+            for (const FieldMap& element : *maps)
+            {
+                appendElement(element, appendFields);
+            }
+        }
+        out += ']';
+    }
+}
+
+void appendFields(std::string& out, const FieldMap& fields)
+{
+    out += '{';
+    bool first{true};
+    for (const auto& [name, value] : fields)
+    {
+        if (!first)
+        {
+            out += ',';
+        }
+        first = false;
+        appendString(out, name.str());
+        out += ':';
+        appendValue(out, value);
+    }
+    out += '}';
+}
+
+std::string_view getTypeName(const ChangeData::ChangeType type)
+{
+    switch (type)
+    {
+    case ChangeData::ChangeType::CREATE_UPDATE:
+        return "CREATE_UPDATE";
+    case ChangeData::ChangeType::DELETED:
+        return "DELETED";
+    default:
+        return "UNKNOWN";
+    }
+}
+
+void appendChangeSet(std::string& out, const uint64_t position, const ChangeData::ChangeSetData& changeSet)
+{
+    out += "{\"frame\":";
+    appendUnsigned(out, position);
+    out += ",\"timestamp\":";
+    appendUnsigned(out, changeSet.timeStamp);
+    out += ",\"time\":";
+    appendTime(out, changeSet.timeStamp);
+    out += ",\"changes\":[";
+    for (uint64_t i = 0; i < changeSet.changes.size(); i++)
+    {
+        const ChangeData::SingleChange& change = changeSet.changes[i];
+        if (i)
+        {
+            out += ',';
+        }
+        out += "{\"name\":";
+        appendString(out, change.name);
+        out += ",\"type\":\"";
+        out += getTypeName(change.type);
+        out += '"';
+        if (change.type == ChangeData::ChangeType::CREATE_UPDATE)
+        {
+            out += ",\"fields\":";
+            appendFields(out, change.getFields());
+        }
+        out += '}';
+    }
+    out += "]}\n";
+}
+} // namespace
+
+JsonLinesWriter::JsonLinesWriter(const int outputFd)
+    : fd{outputFd}
+{
+    for (uint32_t i = 0; i < FORMAT_WORKERS; i++)
+    {
+        formatters.emplace_back([this]() { formatStage(); });
+    }
+    writer = std::jthread{[this]() { writeStage(); }};
+}
+
+JsonLinesWriter::~JsonLinesWriter()
+{
+    finish();
+}
+
+bool JsonLinesWriter::finish()
+{
+    if (!finished)
+    {
+        finished = true;
+        toFormat.close();
+        formatters.clear();
+        toWrite.close();
+        writer.join();
+    }
+    return !failed;
+}
+
+uint64_t JsonLinesWriter::getLineCount() const
+{
+    return lineCount;
+}
+
+void JsonLinesWriter::onReset(const ChangeData::Frame& frame)
+{
+    submit({.reset = true, .position = frame.position, .frame = {}});
+}
+
+void JsonLinesWriter::onFrame(ChangeData::Frame& frame)
+{
+    if (frame.type != ChangeData::FrameType::CHANGE_SET || frame.changeSetData.empty())
+    {
+        return;
+    }
+
+    /* Formatting happens later on, the frame keeps the fields and whatever they point into alive until then */
+    submit({.position = frame.position, .frame = std::move(frame)});
+}
+
+void JsonLinesWriter::submit(Job&& job)
+{
+    inFlight.acquire();
+    job.sequence = nextSequence++;
+    toFormat.push(std::move(job));
+}
+
+void JsonLinesWriter::formatStage()
+{
+    while (std::optional<Job> job = toFormat.pop())
+    {
+        /* Buffers go back and forth with the writer, their capacity only grows once */
+        Chunk chunk{.sequence = job->sequence, .lineCount = 0, .text = takeSpareBuffer()};
+        std::string& buffer = chunk.text;
+        if (job->reset)
+        {
+            buffer += "{\"frame\":";
+            appendUnsigned(buffer, job->position);
+            buffer += ",\"reset\":true}\n";
+            chunk.lineCount = 1;
+        }
+        for (const auto& changeSet : job->frame.changeSetData)
+        {
+            appendChangeSet(buffer, job->position, changeSet);
+            chunk.lineCount++;
+        }
+
+        /* Done with the frame before the chunk goes out, whatever it held gets freed by this worker */
+        job.reset();
+        toWrite.push(std::move(chunk));
+    }
+}
+
+void JsonLinesWriter::writeStage()
+{
+    /* Workers finish frames in any order, hold on to the early ones until every frame before them is out */
+    std::map<uint64_t, Chunk> finishedEarly;
+    uint64_t nextToWrite{0};
+    std::vector<Chunk> batch;
+    uint64_t batchBytes{0};
+    while (std::optional<Chunk> chunk = toWrite.pop())
+    {
+        finishedEarly.emplace(chunk->sequence, std::move(*chunk));
+        while (!finishedEarly.empty() && finishedEarly.begin()->first == nextToWrite)
+        {
+            auto next = finishedEarly.extract(finishedEarly.begin());
+            lineCount += next.mapped().lineCount;
+            batchBytes += next.mapped().text.size();
+            batch.push_back(std::move(next.mapped()));
+            nextToWrite++;
+            inFlight.release();
+
+            if (batchBytes >= WRITE_BATCH_BYTES || batch.size() >= IOV_MAX)
+            {
+                writeOut(batch);
+                batchBytes = 0;
+            }
+        }
+    }
+    writeOut(batch);
+}
+
+void JsonLinesWriter::writeOut(std::vector<Chunk>& batch)
+{
+    std::vector<iovec> parts;
+    parts.reserve(batch.size());
+    for (Chunk& chunk : batch)
+    {
+        if (!chunk.text.empty())
+        {
+            parts.push_back({.iov_base = chunk.text.data(), .iov_len = chunk.text.size()});
+        }
+    }
+
+    uint64_t first{0};
+    while (first < parts.size() && !failed)
+    {
+        const ssize_t written = ::writev(fd, parts.data() + first, parts.size() - first);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            printlne("Failed to write JSON lines: %s", std::strerror(errno));
+            failed = true;
+            break;
+        }
+
+        /* Skip what got written, the part it stopped in only partly */
+        uint64_t left = written;
+        for (; first < parts.size() && left >= parts[first].iov_len; first++)
+        {
+            left -= parts[first].iov_len;
+        }
+        if (left)
+        {
+            parts[first].iov_base = static_cast<char*>(parts[first].iov_base) + left;
+            parts[first].iov_len -= left;
+        }
+    }
+
+    /* One spare per worker is enough to go round, more would only hold on to the capacity of past frames */
+    std::scoped_lock lock{spareMutex};
+    for (Chunk& chunk : batch)
+    {
+        if (spareBuffers.size() < FORMAT_WORKERS)
+        {
+            chunk.text.clear();
+            spareBuffers.push_back(std::move(chunk.text));
+        }
+    }
+    batch.clear();
+}
+
+std::string JsonLinesWriter::takeSpareBuffer()
+{
+    std::scoped_lock lock{spareMutex};
+    if (spareBuffers.empty())
+    {
+        return {};
+    }
+    std::string buffer = std::move(spareBuffers.back());
+    spareBuffers.pop_back();
+    return buffer;
+}
+
+} // namespace hk
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <semaphore>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BoundedQueue.hpp"
+#include "RedactedDecoder.hpp"
+
+namespace hk
+{
+
+/* Writes the recording out as JSON Lines: one line per change set holding its changes and their fields, one per
+   RESET frame. Frames get moved over to workers of their own which format them, each into a buffer of its own,
+   while decoding goes on. Buffers get handed over to a writer thread as they are, which puts them back in recording
+   order, writes them out a batch at a time with a single writev and hands them back for reuse. */
+class JsonLinesWriter : public ChangeData::Visitor
+{
+public:
+    /**
+        @brief Write to the file descriptor _outputFd_, which has to stay open until finish returns
+    */
+    explicit JsonLinesWriter(const int outputFd);
+    ~JsonLinesWriter() override;
+
+    JsonLinesWriter(const JsonLinesWriter&) = delete;
+    JsonLinesWriter& operator=(const JsonLinesWriter&) = delete;
+
+    /**
+        @brief Wait for every line handed over so far to be written out. Returns false if writing failed.
+    */
+    bool finish();
+
+    /**
+        @brief Number of lines written, only settled once finish returned
+    */
+    uint64_t getLineCount() const;
+
+    void onReset(const ChangeData::Frame& frame) override;
+    void onFrame(ChangeData::Frame& frame) override;
+
+private:
+    struct Job
+    {
+        uint64_t sequence{0};
+        /* RESET frames only need their position */
+        bool reset{false};
+        uint64_t position{0};
+        ChangeData::Frame frame;
+    };
+
+    struct Chunk
+    {
+        uint64_t sequence{0};
+        uint64_t lineCount{0};
+        std::string text;
+    };
+
+    void submit(Job&& job);
+    void formatStage();
+    void writeStage();
+
+    /**
+        @brief Write the text of every chunk of _batch_ in order, then recycle their buffers and empty _batch_
+    */
+    void writeOut(std::vector<Chunk>& batch);
+
+    /**
+        @brief Get an empty buffer, one already written out if there is any so that its capacity gets reused
+    */
+    std::string takeSpareBuffer();
+
+private:
+    static constexpr uint32_t FORMAT_WORKERS{4};
+    static constexpr uint64_t QUEUE_SIZE{8};
+    /* Frames handed over but not written yet, bounds what the writer holds back while restoring their order */
+    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT{32};
+    /* Bytes gathered before they get written out */
+    static constexpr uint64_t WRITE_BATCH_BYTES{1024 * 1024};
+
+    const int fd;
+    uint64_t nextSequence{0};
+    utils::BoundedQueue<Job> toFormat{QUEUE_SIZE};
+    utils::BoundedQueue<Chunk> toWrite{QUEUE_SIZE};
+    std::counting_semaphore<MAX_FRAMES_IN_FLIGHT> inFlight{MAX_FRAMES_IN_FLIGHT};
+    std::vector<std::jthread> formatters;
+    std::jthread writer;
+    bool finished{false};
+
+    /* Buffers written out, waiting to be formatted into again */
+    std::mutex spareMutex;
+    std::vector<std::string> spareBuffers;
+
+    /* Only touched by the writer thread until finish joined it */
+    bool failed{false};
+    uint64_t lineCount{0};
+};
+
+} // namespace hk
@@ -0,0 +1,73 @@
+#include "MappedFile.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Utility.hpp"
+
+namespace utils
+{
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const std::filesystem::path& path)
+{
+    close();
+
+    const int32_t fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    /* Nothing to map, but an empty file is still a valid (empty) input */
+    if (fileStat.st_size == 0)
+    {
+        ::close(fd);
+        return true;
+    }
+
+    void* mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        printlne("Failed to map %s", path.c_str());
+        return false;
+    }
+
+    /* Frames are walked front to back, let the kernel read ahead aggressively */
+    madvise(mapping, fileStat.st_size, MADV_SEQUENTIAL);
+
+    data = static_cast<const uint8_t*>(mapping);
+    size = fileStat.st_size;
+    return true;
+}
+
+std::span<const uint8_t> MappedFile::bytes() const
+{
+    return {data, size};
+}
+
+void MappedFile::close()
+{
+    if (data)
+    {
+        munmap(const_cast<uint8_t*>(data), size);
+    }
+    data = nullptr;
+    size = 0;
+}
+
+} // namespace utils
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+
+namespace utils
+{
+
+/* Read-only memory mapping of a whole file. Only regular files can be mapped, pipes and other non-seekable inputs
+   have to go through the stream readers. */
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    /**
+        @brief Map the file at _path_. Returns false if the file can't be opened or isn't a regular file.
+    */
+    bool open(const std::filesystem::path& path);
+
+    std::span<const uint8_t> bytes() const;
+
+private:
+    void close();
+
+private:
+    const uint8_t* data{nullptr};
+    uint64_t size{0};
+};
+
+} // namespace utils
@@ -0,0 +1,595 @@
+#include "MetaSchema.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+
+#include "CacheFile.hpp"
+#include "Utility.hpp"
+
+namespace hk
+{
+namespace
+{
+using utils::CacheReader;
+using utils::CacheWriter;
+
+constexpr uint32_t NO_INDEX{UINT32_MAX};
+} // namespace
+
+const MetaSchema::FieldDescriptor* MetaSchema::MessageSchema::getField(const uint64_t fieldNumber) const
+{
+    if (fieldNumber < fields.size())
+    {
+        const FieldDescriptor& field = fields[fieldNumber];
+        return field.isPresent ? &field : nullptr;
+    }
+
+    if (overflowFields.empty())
+    {
+        return nullptr;
+    }
+
+    const auto it = std::lower_bound(overflowFields.begin(), overflowFields.end(), fieldNumber,
+        [](const auto& entry, const uint64_t number) { return entry.first < number; });
+    if (it == overflowFields.end() || it->first != fieldNumber)
+    {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+const std::string* MetaSchema::EnumTable::getName(const uint64_t value) const
+{
+    if (!denseNames.empty())
+    {
+        const uint64_t position = value - minValue;
+        return value >= minValue && position < denseNames.size() ? denseNames[position] : nullptr;
+    }
+
+    const auto it = std::lower_bound(sortedNames.begin(), sortedNames.end(), value,
+        [](const auto& entry, const uint64_t v) { return entry.first < v; });
+    if (it == sortedNames.end() || it->first != value)
+    {
+        return nullptr;
+    }
+    return it->second;
+}
+
+bool MetaSchema::compileFromXML(const XMLDecoder::XmlResult& firstXML, const XMLDecoder::XmlResult& secondXML)
+{
+    if (firstXML.first.empty() || secondXML.first.empty())
+    {
+        printlne("Cannot compile meta schema out of empty XML");
+        return false;
+    }
+
+    metaVersion = secondXML.first[0]->nodeName == "?xml" ? META_VERSION_TOP_XML : META_VERSION_TOP_NO_XML;
+    if (firstXML.first.size() <= metaVersion || secondXML.first.size() <= metaVersion)
+    {
+        printlne("Meta XML has no top level node to compile");
+        return false;
+    }
+
+    indexObjects(firstXML.first[metaVersion]);
+    indexObjects(secondXML.first[metaVersion]);
+
+    /* Drop the compile time scratch maps, they also keep the whole DOM alive */
+    compiledNodes.clear();
+    compiledEnumerations.clear();
+
+    return true;
+}
+
+const MetaSchema::MessageSchema* MetaSchema::getClass(const std::string& className) const
+{
+    const auto it = classIndex.find(className);
+    return it != classIndex.end() ? it->second : nullptr;
+}
+
+uint8_t MetaSchema::getMetaVersion() const
+{
+    return metaVersion;
+}
+
+void MetaSchema::indexObjects(const XMLDecoder::NodeSPtr& node)
+{
+    for (const auto& child : node->children)
+    {
+        if (child->nodeName == "managedObject")
+        {
+            const std::optional<std::string> className = child->getAttribValue("class");
+            if (className && !classIndex.contains(*className))
+            {
+                classIndex.emplace(*className, compileObject(child));
+            }
+        }
+        indexObjects(child);
+    }
+}
+
+const MetaSchema::MessageSchema* MetaSchema::compileObject(const XMLDecoder::NodeSPtr& objectNode)
+{
+    if (const auto it = compiledNodes.find(objectNode); it != compiledNodes.end())
+    {
+        return it->second;
+    }
+
+    /* Register it before going through the fields so a struct referencing itself doesn't recurse forever */
+    MessageSchema& message = messages.emplace_back();
+    compiledNodes[objectNode] = &message;
+
+    const uint64_t childrenCount = objectNode->children.size();
+    for (uint64_t childIndex = 0; childIndex < childrenCount; childIndex++)
+    {
+        const XMLDecoder::NodeSPtr& child = objectNode->children[childIndex];
+        if (child->nodeName == "p" || child->nodeName == "action")
+        {
+            compileField(objectNode, childIndex, message);
+        }
+    }
+
+    std::stable_sort(message.overflowFields.begin(), message.overflowFields.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    assignSlots(message);
+
+    return &message;
+}
+
+void MetaSchema::compileField(const XMLDecoder::NodeSPtr& objectNode,
+    const uint64_t childIndex,
+    MessageSchema& message)
+{
+    const XMLDecoder::NodeSPtr& pOrActionNode = objectNode->children[childIndex];
+    const uint64_t fieldNumber = getFieldNumber(pOrActionNode);
+
+    /* First "p"/"action" node declaring a field number wins, same as the linear search used to do. */
+    FieldDescriptor* field{nullptr};
+    if (fieldNumber < MAX_DENSE_FIELD_NUMBER)
+    {
+        if (message.fields.size() <= fieldNumber)
+        {
+            message.fields.resize(fieldNumber + 1);
+        }
+        field = &message.fields[fieldNumber];
+    }
+    else
+    {
+        const auto it = std::find_if(message.overflowFields.begin(), message.overflowFields.end(),
+            [fieldNumber](const auto& entry) { return entry.first == fieldNumber; });
+        field = it != message.overflowFields.end() ? &it->second
+                                                   : &message.overflowFields.emplace_back(fieldNumber,
+                                                          FieldDescriptor{}).second;
+    }
+
+    if (field->isPresent)
+    {
+        return;
+    }
+
+    const std::string typeName = pOrActionNode->getAttribValue("type").value_or("UNKNOWN");
+    const std::string recurrence = pOrActionNode->getAttribValue("recurrence").value_or("UNKNOWN");
+    const auto& pChildren = pOrActionNode->children;
+
+    field->isPresent = true;
+    field->name = FieldName{*intern(pOrActionNode->getAttribValue("name").value_or("??")), 0};
+    field->isRepeated = recurrence == "repeated";
+    field->isPacked = field->isRepeated &&
+                      (metaVersion == META_VERSION_TOP_NO_XML ||
+                          (!pChildren.empty() && pChildren.back()->getAttribValue("packed").value_or("?") == "true"));
+    field->type = getFieldType(typeName, objectNode, childIndex);
+
+    /* Enums and structs are described by the node right above the "p"/"action" node. */
+    if (field->type == FieldType::ENUMERATION)
+    {
+        field->enumeration = compileEnumeration(objectNode->children[childIndex - 1]);
+    }
+    else if (field->type == FieldType::STRUCT)
+    {
+        field->nestedStruct = compileObject(objectNode->children[childIndex - 1]);
+    }
+}
+
+MetaSchema::FieldType MetaSchema::getFieldType(const std::string& typeName,
+    const XMLDecoder::NodeSPtr& objectNode,
+    const uint64_t childIndex) const
+{
+    if (typeName == "integer")
+    {
+        return FieldType::INTEGER;
+    }
+    else if (typeName == "double")
+    {
+        return FieldType::DOUBLE;
+    }
+    else if (typeName == "boolean")
+    {
+        return FieldType::BOOLEAN;
+    }
+    else if (typeName == "string")
+    {
+        return FieldType::STRING;
+    }
+
+    /* Some objects don't follow the META correctly and have no node above the "p"/"action" one (GNSS). Decoder
+       will complain about those when it meets them. */
+    if (childIndex == 0)
+    {
+        return FieldType::UNKNOWN;
+    }
+
+    return objectNode->children[childIndex - 1]->nodeName == "enumeration" ? FieldType::ENUMERATION
+                                                                           : FieldType::STRUCT;
+}
+
+uint64_t MetaSchema::getFieldNumber(const XMLDecoder::NodeSPtr& pOrActionNode) const
+{
+    /* "proto" will always be the last node.. except for the meta version in which "proto" in BM is not present and
+       we need to check the "id" attribute instead. */
+    const uint64_t childrenCount = pOrActionNode->children.size();
+    std::string indexValue;
+    if (childrenCount == 0 || pOrActionNode->children[childrenCount - 1]->nodeName != "proto")
+    {
+        indexValue = pOrActionNode->getAttribValue("id").value_or("0");
+    }
+    else
+    {
+        indexValue = pOrActionNode->children[childrenCount - 1]->getAttribValue("index").value_or("0");
+    }
+
+    uint64_t fieldNumber{0};
+    const char* indexEnd = indexValue.data() + indexValue.size();
+    const auto [ptr, ec] = std::from_chars(indexValue.data(), indexEnd, fieldNumber);
+    if (ec != std::errc() || ptr != indexEnd)
+    {
+        printlne("Invalid field index '%s', treating it as 0", indexValue.c_str());
+        return 0;
+    }
+    return fieldNumber;
+}
+
+const MetaSchema::EnumTable* MetaSchema::compileEnumeration(const XMLDecoder::NodeSPtr& enumerationNode)
+{
+    if (const auto it = compiledEnumerations.find(enumerationNode); it != compiledEnumerations.end())
+    {
+        return it->second;
+    }
+
+    std::vector<std::pair<uint64_t, const std::string*>> values;
+    collectEnumValues(enumerationNode, values);
+
+    /* Stable so that, like the old DOM search, the first "enum" node declaring a value wins */
+    std::stable_sort(values.begin(), values.end(),
+        [](const auto& lhs, const auto& rhs) { return lhs.first < rhs.first; });
+    values.erase(std::unique(values.begin(), values.end(),
+                     [](const auto& lhs, const auto& rhs) { return lhs.first == rhs.first; }),
+        values.end());
+
+    EnumTable& table = enumerations.emplace_back();
+    compiledEnumerations[enumerationNode] = &table;
+
+    if (values.empty())
+    {
+        return &table;
+    }
+
+    /* Go dense only when at most about half of the slots would be left empty */
+    const uint64_t range = values.back().first - values.front().first;
+    if (range < 2 * values.size() + 16)
+    {
+        table.minValue = values.front().first;
+        table.denseNames.resize(range + 1, nullptr);
+        for (const auto& [value, name] : values)
+        {
+            table.denseNames[value - table.minValue] = name;
+        }
+    }
+    else
+    {
+        table.sortedNames = std::move(values);
+    }
+
+    return &table;
+}
+
+void MetaSchema::collectEnumValues(const XMLDecoder::NodeSPtr& node,
+    std::vector<std::pair<uint64_t, const std::string*>>& out)
+{
+    for (const auto& child : node->children)
+    {
+        if (child->nodeName != "enum")
+        {
+            collectEnumValues(child, out);
+            continue;
+        }
+
+        const std::string valueStr = child->getAttribValue("value").value_or("");
+        const char* valueEnd = valueStr.data() + valueStr.size();
+
+        /* Negative enum values travel on the wire as 64 bit two's complement varints */
+        int64_t value{0};
+        const auto [ptr, ec] = std::from_chars(valueStr.data(), valueEnd, value);
+        if (ec != std::errc() || ptr != valueEnd)
+        {
+            uint64_t unsignedValue{0};
+            const auto [uPtr, uEc] = std::from_chars(valueStr.data(), valueEnd, unsignedValue);
+            if (uEc != std::errc() || uPtr != valueEnd)
+            {
+                printlne("Invalid enum value '%s'. Skip", valueStr.c_str());
+                continue;
+            }
+            value = static_cast<int64_t>(unsignedValue);
+        }
+
+        out.emplace_back(static_cast<uint64_t>(value),
+            intern(child->getAttribValue("name").value_or("VALUE_NOT_FOUND")));
+    }
+}
+
+const std::string* MetaSchema::intern(const std::string& name)
+{
+    return &*internedNames.emplace(name).first;
+}
+
+void MetaSchema::assignSlots(MessageSchema& message)
+{
+    /* Decoder merges fields sharing a name into one value, so they share the slot as well */
+    std::unordered_map<const std::string*, uint32_t> slots;
+    const auto assign = [&slots](FieldDescriptor& field)
+    {
+        const std::string& name = field.name.str();
+        const uint32_t slot = slots.emplace(&name, slots.size()).first->second;
+        field.name = FieldName{name, slot};
+    };
+
+    for (FieldDescriptor& field : message.fields)
+    {
+        if (field.isPresent)
+        {
+            assign(field);
+        }
+    }
+    for (auto& [fieldNumber, field] : message.overflowFields)
+    {
+        assign(field);
+    }
+}
+
+bool MetaSchema::saveToFile(const std::filesystem::path& path, const uint64_t metaHash) const
+{
+    /* Pointers are stored as positions inside their container */
+    std::unordered_map<const std::string*, uint32_t> nameIndex;
+    std::unordered_map<const EnumTable*, uint32_t> enumIndex;
+    std::unordered_map<const MessageSchema*, uint32_t> messageIndex;
+    for (const std::string& name : internedNames)
+    {
+        nameIndex.emplace(&name, nameIndex.size());
+    }
+    for (const EnumTable& table : enumerations)
+    {
+        enumIndex.emplace(&table, enumIndex.size());
+    }
+    for (const MessageSchema& message : messages)
+    {
+        messageIndex.emplace(&message, messageIndex.size());
+    }
+
+    const auto getNameIndex = [&nameIndex](const std::string* name) { return name ? nameIndex.at(name) : NO_INDEX; };
+
+    CacheWriter payload;
+    payload.put<uint8_t>(metaVersion);
+
+    payload.put<uint32_t>(internedNames.size());
+    for (const std::string& name : internedNames)
+    {
+        payload.putString(name);
+    }
+
+    payload.put<uint32_t>(enumerations.size());
+    for (const EnumTable& table : enumerations)
+    {
+        payload.put<uint64_t>(table.minValue);
+        payload.put<uint32_t>(table.denseNames.size());
+        for (const std::string* name : table.denseNames)
+        {
+            payload.put<uint32_t>(getNameIndex(name));
+        }
+        payload.put<uint32_t>(table.sortedNames.size());
+        for (const auto& [value, name] : table.sortedNames)
+        {
+            payload.put<uint64_t>(value);
+            payload.put<uint32_t>(getNameIndex(name));
+        }
+    }
+
+    const auto putField = [&](const uint64_t fieldNumber, const FieldDescriptor& field)
+    {
+        payload.put<uint64_t>(fieldNumber);
+        payload.putString(field.name.str());
+        payload.put<uint8_t>(static_cast<uint8_t>(field.type));
+        payload.put<uint8_t>(field.isRepeated | field.isPacked << 1);
+        payload.put<uint32_t>(field.nestedStruct ? messageIndex.at(field.nestedStruct) : NO_INDEX);
+        payload.put<uint32_t>(field.enumeration ? enumIndex.at(field.enumeration) : NO_INDEX);
+    };
+
+    payload.put<uint32_t>(messages.size());
+    for (const MessageSchema& message : messages)
+    {
+        const uint32_t presentCount = std::count_if(message.fields.begin(), message.fields.end(),
+            [](const FieldDescriptor& field) { return field.isPresent; });
+        payload.put<uint32_t>(presentCount + message.overflowFields.size());
+        for (uint64_t fieldNumber = 0; fieldNumber < message.fields.size(); fieldNumber++)
+        {
+            if (message.fields[fieldNumber].isPresent)
+            {
+                putField(fieldNumber, message.fields[fieldNumber]);
+            }
+        }
+        for (const auto& [fieldNumber, field] : message.overflowFields)
+        {
+            putField(fieldNumber, field);
+        }
+    }
+
+    payload.put<uint32_t>(classIndex.size());
+    for (const auto& [className, message] : classIndex)
+    {
+        payload.putString(className);
+        payload.put<uint32_t>(messageIndex.at(message));
+    }
+
+    CacheWriter header;
+    header.put<uint64_t>(CACHE_MAGIC);
+    header.put<uint32_t>(CACHE_FORMAT_VERSION);
+    header.put<uint64_t>(metaHash);
+    header.put<uint64_t>(payload.bytes.size());
+    header.put<uint64_t>(utils::hashBytes(payload.bytes.data(), payload.bytes.size()));
+
+    return utils::writeCacheFile(path, header, payload);
+}
+
+bool MetaSchema::loadFromFile(const std::filesystem::path& path, const uint64_t metaHash)
+{
+    std::vector<uint8_t> bytes;
+    if (!utils::readCacheFile(path, bytes))
+    {
+        return false;
+    }
+
+    CacheReader header{.data = bytes.data(), .size = bytes.size()};
+    const uint64_t magic = header.get<uint64_t>();
+    const uint32_t formatVersion = header.get<uint32_t>();
+    const uint64_t storedMetaHash = header.get<uint64_t>();
+    const uint64_t payloadSize = header.get<uint64_t>();
+    const uint64_t payloadHash = header.get<uint64_t>();
+    if (!header.ok || magic != CACHE_MAGIC || formatVersion != CACHE_FORMAT_VERSION || storedMetaHash != metaHash)
+    {
+        printlne("Schema cache %s is stale, ignoring it", path.c_str());
+        return false;
+    }
+    if (payloadSize != bytes.size() - header.pos ||
+        utils::hashBytes(bytes.data() + header.pos, payloadSize) != payloadHash)
+    {
+        printlne("Schema cache %s is corrupted, ignoring it", path.c_str());
+        return false;
+    }
+
+    CacheReader reader{.data = bytes.data() + header.pos, .size = payloadSize};
+    metaVersion = reader.get<uint8_t>();
+
+    /* Every stored index is checked, a bad one makes the whole file invalid */
+    const uint32_t nameCount = reader.get<uint32_t>();
+    if (reader.ok && nameCount > reader.size - reader.pos)
+    {
+        reader.ok = false;
+    }
+    std::vector<const std::string*> names(reader.ok ? nameCount : 0);
+    for (uint32_t i = 0; reader.ok && i < nameCount; i++)
+    {
+        names[i] = intern(reader.getString());
+    }
+    const auto getName = [&](const uint32_t index) -> const std::string*
+    {
+        if (index != NO_INDEX && index >= names.size())
+        {
+            reader.ok = false;
+        }
+        return index < names.size() ? names[index] : nullptr;
+    };
+
+    const uint32_t enumCount = reader.get<uint32_t>();
+    for (uint32_t i = 0; reader.ok && i < enumCount; i++)
+    {
+        EnumTable& table = enumerations.emplace_back();
+        table.minValue = reader.get<uint64_t>();
+        const uint32_t denseCount = reader.get<uint32_t>();
+        for (uint32_t j = 0; reader.ok && j < denseCount; j++)
+        {
+            table.denseNames.emplace_back(getName(reader.get<uint32_t>()));
+        }
+        const uint32_t sortedCount = reader.get<uint32_t>();
+        for (uint32_t j = 0; reader.ok && j < sortedCount; j++)
+        {
+            const uint64_t value = reader.get<uint64_t>();
+            table.sortedNames.emplace_back(value, getName(reader.get<uint32_t>()));
+        }
+    }
+
+    /* Messages reference each other so create all of them before filling any in */
+    const uint32_t messageCount = reader.get<uint32_t>();
+    if (reader.ok && messageCount > reader.size)
+    {
+        reader.ok = false;
+    }
+    messages.resize(reader.ok ? messageCount : 0);
+    for (MessageSchema& message : messages)
+    {
+        const uint32_t fieldCount = reader.get<uint32_t>();
+        for (uint32_t j = 0; reader.ok && j < fieldCount; j++)
+        {
+            const uint64_t fieldNumber = reader.get<uint64_t>();
+            FieldDescriptor field;
+            field.isPresent = true;
+            field.name = FieldName{*intern(reader.getString()), 0};
+            field.type = static_cast<FieldType>(reader.get<uint8_t>());
+            const uint8_t flags = reader.get<uint8_t>();
+            field.isRepeated = flags & 1;
+            field.isPacked = flags & 2;
+            const uint32_t nestedIndex = reader.get<uint32_t>();
+            const uint32_t enumerationIndex = reader.get<uint32_t>();
+            if ((nestedIndex != NO_INDEX && nestedIndex >= messages.size()) ||
+                (enumerationIndex != NO_INDEX && enumerationIndex >= enumerations.size()) ||
+                field.type > FieldType::UNKNOWN || (field.type == FieldType::STRUCT && nestedIndex == NO_INDEX) ||
+                (field.type == FieldType::ENUMERATION && enumerationIndex == NO_INDEX))
+            {
+                reader.ok = false;
+                break;
+            }
+            field.nestedStruct = nestedIndex != NO_INDEX ? &messages[nestedIndex] : nullptr;
+            field.enumeration = enumerationIndex != NO_INDEX ? &enumerations[enumerationIndex] : nullptr;
+
+            if (fieldNumber < MAX_DENSE_FIELD_NUMBER)
+            {
+                if (message.fields.size() <= fieldNumber)
+                {
+                    message.fields.resize(fieldNumber + 1);
+                }
+                message.fields[fieldNumber] = std::move(field);
+            }
+            else
+            {
+                message.overflowFields.emplace_back(fieldNumber, std::move(field));
+            }
+        }
+        assignSlots(message);
+    }
+
+    const uint32_t classCount = reader.get<uint32_t>();
+    for (uint32_t i = 0; reader.ok && i < classCount; i++)
+    {
+        std::string className = reader.getString();
+        const uint32_t index = reader.get<uint32_t>();
+        if (index >= messages.size())
+        {
+            reader.ok = false;
+            break;
+        }
+        classIndex.emplace(std::move(className), &messages[index]);
+    }
+
+    if (!reader.ok || reader.pos != reader.size)
+    {
+        printlne("Schema cache %s is corrupted, ignoring it", path.c_str());
+        messages.clear();
+        enumerations.clear();
+        internedNames.clear();
+        classIndex.clear();
+        return false;
+    }
+    return true;
+}
+
+} // namespace hk
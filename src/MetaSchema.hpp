@@ -0,0 +1,140 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "../deps/HkXML/src/HkXml.hpp"
+#include "CommonTypes.hpp"
+
+namespace hk
+{
+
+#define META_VERSION_TOP_XML 1
+#define META_VERSION_TOP_NO_XML 0
+
+/* Compiled form of the "managedObject" nodes found in meta.xml. Each object (and each struct nested inside it) is
+   turned into a table indexed directly by protobuf field number so the decoder never has to walk the XML DOM or
+   compare strings while decoding. */
+class MetaSchema
+{
+public:
+    enum class FieldType : uint8_t
+    {
+        INTEGER,
+        DOUBLE,
+        BOOLEAN,
+        STRING,
+        ENUMERATION,
+        STRUCT,
+        UNKNOWN
+    };
+
+    struct MessageSchema;
+
+    /* Value -> name table of an "enumeration" node. Compact value ranges are stored densely, anything else is kept
+       sorted by value. Names point into the schema's interned name pool. */
+    struct EnumTable
+    {
+        uint64_t minValue{0};
+        std::vector<const std::string*> denseNames;
+        std::vector<std::pair<uint64_t, const std::string*>> sortedNames;
+
+        /**
+            @brief Get the name of enum _value_ or nullptr if the enumeration doesn't know it
+        */
+        const std::string* getName(const uint64_t value) const;
+    };
+
+    struct FieldDescriptor
+    {
+        /* Interned, slots number the distinct field names of a message in field number order */
+        FieldName name;
+        FieldType type{FieldType::UNKNOWN};
+        bool isRepeated{false};
+        bool isPacked{false};
+        bool isPresent{false};
+        const MessageSchema* nestedStruct{nullptr};
+        const EnumTable* enumeration{nullptr};
+    };
+
+    struct MessageSchema
+    {
+        /* Dense table, position == field number. Absurdly high field numbers go in the sorted overflow table. */
+        std::vector<FieldDescriptor> fields;
+        std::vector<std::pair<uint64_t, FieldDescriptor>> overflowFields;
+
+        const FieldDescriptor* getField(const uint64_t fieldNumber) const;
+    };
+
+    /**
+        @brief Compile every "managedObject" of _firstXML_ and _secondXML_ into the class index in a single pass.
+        Classes present in both documents are taken from _firstXML_. Once done the schema is never modified so
+        it can be read from any number of threads without locking.
+    */
+    bool compileFromXML(const XMLDecoder::XmlResult& firstXML, const XMLDecoder::XmlResult& secondXML);
+
+    /**
+        @brief Get the compiled table of _className_ or nullptr if the meta doesn't describe it
+    */
+    const MessageSchema* getClass(const std::string& className) const;
+
+    /**
+        @brief Get the meta version detected while compiling (META_VERSION_TOP_XML/META_VERSION_TOP_NO_XML)
+    */
+    uint8_t getMetaVersion() const;
+
+    /**
+        @brief Store the compiled schema at _path_ in a compact binary form tagged with _metaHash_
+    */
+    bool saveToFile(const std::filesystem::path& path, const uint64_t metaHash) const;
+
+    /**
+        @brief Load a schema stored by saveToFile. Files that are truncated, corrupted, written by another cache
+        format version or tagged with another _metaHash_ are rejected.
+    */
+    bool loadFromFile(const std::filesystem::path& path, const uint64_t metaHash);
+
+private:
+    void indexObjects(const XMLDecoder::NodeSPtr& node);
+
+    const MessageSchema* compileObject(const XMLDecoder::NodeSPtr& objectNode);
+
+    void compileField(const XMLDecoder::NodeSPtr& objectNode, const uint64_t childIndex, MessageSchema& message);
+
+    FieldType getFieldType(const std::string& typeName,
+        const XMLDecoder::NodeSPtr& objectNode,
+        const uint64_t childIndex) const;
+
+    uint64_t getFieldNumber(const XMLDecoder::NodeSPtr& pOrActionNode) const;
+
+    const EnumTable* compileEnumeration(const XMLDecoder::NodeSPtr& enumerationNode);
+
+    void collectEnumValues(const XMLDecoder::NodeSPtr& node, std::vector<std::pair<uint64_t, const std::string*>>& out);
+
+    const std::string* intern(const std::string& name);
+
+    void assignSlots(MessageSchema& message);
+
+private:
+    static constexpr uint64_t MAX_DENSE_FIELD_NUMBER{1 << 16};
+    static constexpr uint64_t CACHE_MAGIC{0x414d454843534b48}; // "HKSCHEMA"
+    static constexpr uint32_t CACHE_FORMAT_VERSION{1};
+
+    /* Deques so that pointers handed out while compiling stay valid as more objects get compiled */
+    std::deque<MessageSchema> messages;
+    std::deque<EnumTable> enumerations;
+    std::unordered_set<std::string> internedNames;
+    std::unordered_map<std::string, const MessageSchema*> classIndex;
+    uint8_t metaVersion{META_VERSION_TOP_XML};
+
+    /* Only used while compiling, so nodes shared between objects get compiled once */
+    std::unordered_map<XMLDecoder::NodeSPtr, const MessageSchema*> compiledNodes;
+    std::unordered_map<XMLDecoder::NodeSPtr, const EnumTable*> compiledEnumerations;
+};
+
+} // namespace hk
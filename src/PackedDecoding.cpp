@@ -0,0 +1,273 @@
+#include "PackedDecoding.hpp"
+
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HK_X86_KERNELS
+#endif
+
+namespace hk
+{
+namespace
+{
+/* Every varint ends with a byte that has the continuation bit cleared, counting those sizes the output up front */
+using CountKernel = uint64_t (*)(const uint8_t* data, uint64_t index, const uint64_t endIndex);
+
+/* Decoded values get written through _out_, which is moved past them. Returns the index past the last varint. */
+using DecodeKernel = uint64_t (*)(const uint8_t* data,
+    const uint64_t size,
+    uint64_t index,
+    const uint64_t endIndex,
+    uint64_t*& out);
+
+struct Kernels
+{
+    CountKernel count{nullptr};
+    DecodeKernel decode{nullptr};
+    const char* name{nullptr};
+};
+
+constexpr uint64_t CONTINUATION_BITS{0x8080808080808080};
+
+/* Same decoding as ProtobufDecoder::decodeVarInt, for whatever can't be widened in bulk. Lengths repeat a lot within
+   a packed array, so the byte loop is well predicted and beats computing the length out of a full load. */
+inline uint64_t decodeOne(const uint8_t* data, const uint64_t size, uint64_t& index)
+{
+    uint64_t result{0};
+    uint8_t byteCount{0};
+    while (index < size)
+    {
+        const uint8_t varintPart = data[index++];
+        result |= (uint64_t)(varintPart & 0b01111111) << (7 * byteCount);
+        ++byteCount;
+        if (!(varintPart & 0b10000000))
+        {
+            break;
+        }
+    }
+    return result;
+}
+
+/* Bytes ahead of the first one with the continuation bit are all single byte varints */
+inline void copySingles(const uint8_t* data, uint64_t& index, const uint32_t count, uint64_t*& out)
+{
+    for (uint32_t i = 0; i < count; i++)
+    {
+        out[i] = data[index + i];
+    }
+    out += count;
+    index += count;
+}
+
+/* Decode varints until _index_ reaches _blockEnd_. The last one may end past it when it isn't terminated in there.
+   The kernels hand the rest of a run over to this as soon as a block holds a longer varint: runs mixing lengths
+   don't stay single byte for long, and checking every block of them again only made them slower than this loop. */
+inline uint64_t decodeBlock(const uint8_t* data,
+    const uint64_t size,
+    uint64_t index,
+    const uint64_t blockEnd,
+    uint64_t*& out)
+{
+    while (index < blockEnd)
+    {
+        *out++ = decodeOne(data, size, index);
+    }
+    return index;
+}
+
+/* The last varint counts even when it doesn't end in range */
+inline uint64_t countTail(const uint8_t* data, uint64_t index, const uint64_t endIndex)
+{
+    uint64_t count = data[endIndex - 1] & 0b10000000 ? 1 : 0;
+    for (; index < endIndex; index++)
+    {
+        count += !(data[index] & 0b10000000);
+    }
+    return count;
+}
+
+uint64_t countScalar(const uint8_t* data, uint64_t index, const uint64_t endIndex)
+{
+    uint64_t count{0};
+    for (; endIndex - index >= 8; index += 8)
+    {
+        uint64_t block;
+        std::memcpy(&block, data + index, sizeof(block));
+        count += std::popcount(~block & CONTINUATION_BITS);
+    }
+    return count + countTail(data, index, endIndex);
+}
+
+uint64_t decodeScalar(const uint8_t* data, const uint64_t size, uint64_t index, const uint64_t endIndex, uint64_t*& out)
+{
+    while (endIndex - index >= 8)
+    {
+        uint64_t block;
+        std::memcpy(&block, data + index, sizeof(block));
+        if (block & CONTINUATION_BITS)
+        {
+            break;
+        }
+        copySingles(data, index, 8, out);
+    }
+    return decodeBlock(data, size, index, endIndex, out);
+}
+
+#ifdef HK_X86_KERNELS
+__attribute__((target("sse4.1,popcnt"))) uint64_t countSse41(const uint8_t* data,
+    uint64_t index,
+    const uint64_t endIndex)
+{
+    uint64_t count{0};
+    for (; endIndex - index >= 16; index += 16)
+    {
+        const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+        count += 16 - _mm_popcnt_u32(_mm_movemask_epi8(bytes));
+    }
+    return count + countTail(data, index, endIndex);
+}
+
+__attribute__((target("sse4.1"))) uint64_t decodeSse41(const uint8_t* data,
+    const uint64_t size,
+    uint64_t index,
+    const uint64_t endIndex,
+    uint64_t*& out)
+{
+    while (endIndex - index >= 16)
+    {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+        if (const uint32_t continuations = _mm_movemask_epi8(bytes))
+        {
+            copySingles(data, index, std::countr_zero(continuations), out);
+            return decodeBlock(data, size, index, endIndex, out);
+        }
+
+        /* Sixteen single byte varints, widen them two at a time */
+        for (uint64_t i = 0; i < 16; i += 2)
+        {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_cvtepu8_epi64(bytes));
+            bytes = _mm_srli_si128(bytes, 2);
+        }
+        out += 16;
+        index += 16;
+    }
+    return decodeScalar(data, size, index, endIndex, out);
+}
+
+__attribute__((target("avx2,popcnt"))) uint64_t countAvx2(const uint8_t* data,
+    uint64_t index,
+    const uint64_t endIndex)
+{
+    uint64_t count{0};
+    for (; endIndex - index >= 32; index += 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + index));
+        count += 32 - _mm_popcnt_u32(_mm256_movemask_epi8(bytes));
+    }
+    return count + countTail(data, index, endIndex);
+}
+
+__attribute__((target("avx2"))) uint64_t decodeAvx2(const uint8_t* data,
+    const uint64_t size,
+    uint64_t index,
+    const uint64_t endIndex,
+    uint64_t*& out)
+{
+    while (endIndex - index >= 32)
+    {
+        const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + index));
+        if (const uint32_t continuations = _mm256_movemask_epi8(bytes))
+        {
+            copySingles(data, index, std::countr_zero(continuations), out);
+            return decodeBlock(data, size, index, endIndex, out);
+        }
+
+        /* Thirty two single byte varints, widen them four at a time */
+        __m128i low = _mm256_castsi256_si128(bytes);
+        __m128i high = _mm256_extracti128_si256(bytes, 1);
+        for (uint64_t i = 0; i < 16; i += 4)
+        {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_cvtepu8_epi64(low));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 16 + i), _mm256_cvtepu8_epi64(high));
+            low = _mm_srli_si128(low, 4);
+            high = _mm_srli_si128(high, 4);
+        }
+        out += 32;
+        index += 32;
+    }
+    return decodeSse41(data, size, index, endIndex, out);
+}
+#endif // HK_X86_KERNELS
+
+Kernels selectKernels()
+{
+#ifdef HK_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    {
+        return {.count = countAvx2, .decode = decodeAvx2, .name = "avx2"};
+    }
+    if (__builtin_cpu_supports("sse4.1") && __builtin_cpu_supports("popcnt"))
+    {
+        return {.count = countSse41, .decode = decodeSse41, .name = "sse4.1"};
+    }
+#endif
+    return {.count = countScalar, .decode = decodeScalar, .name = "scalar"};
+}
+
+const Kernels& getKernels()
+{
+    static const Kernels kernels = selectKernels();
+    return kernels;
+}
+} // namespace
+
+uint64_t decodePackedVarInts(const ByteSpan buffer, uint64_t currentIndex, const uint64_t endIndex, IntegerVec& out)
+{
+    if (currentIndex >= endIndex)
+    {
+        return currentIndex;
+    }
+
+    const Kernels& kernels = getKernels();
+    const uint64_t oldSize = out.size();
+    out.resize(oldSize + kernels.count(buffer.data(), currentIndex, endIndex));
+    uint64_t* output = out.data() + oldSize;
+    return kernels.decode(buffer.data(), buffer.size(), currentIndex, endIndex, output);
+}
+
+uint64_t decodePackedDoubles(const ByteSpan buffer, uint64_t currentIndex, const uint64_t endIndex, DoubleVec& out)
+{
+    const uint64_t count = currentIndex < endIndex ? (endIndex - currentIndex) / sizeof(double) : 0;
+    if (!count)
+    {
+        return currentIndex;
+    }
+
+    const uint64_t oldSize = out.size();
+    out.resize(oldSize + count);
+    if constexpr (std::endian::native == std::endian::little)
+    {
+        std::memcpy(out.data() + oldSize, buffer.data() + currentIndex, count * sizeof(double));
+    }
+    else
+    {
+        for (uint64_t i = 0; i < count; i++)
+        {
+            uint64_t bits;
+            std::memcpy(&bits, buffer.data() + currentIndex + i * sizeof(double), sizeof(bits));
+            bits = __builtin_bswap64(bits);
+            std::memcpy(&out[oldSize + i], &bits, sizeof(bits));
+        }
+    }
+    return currentIndex + count * sizeof(double);
+}
+
+const char* getPackedVarIntKernelName()
+{
+    return getKernels().name;
+}
+
+} // namespace hk
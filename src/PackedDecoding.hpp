@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+#include "CommonTypes.hpp"
+
+namespace hk
+{
+
+/**
+    @brief Decode the packed varints found between _currentIndex_ and _endIndex_ of _buffer_ and append them to _out_,
+    which gets sized once up front. Leading single byte varints are widened 16/32 at a time using SSE4.1/AVX2 when
+    the CPU has them (picked at runtime), a portable 8 bytes at a time path is used otherwise. From the first longer
+    varint on, the rest is decoded byte by byte. Returns the index right past the last varint, which is past
+    _endIndex_ when the last varint doesn't end before it.
+*/
+uint64_t decodePackedVarInts(const ByteSpan buffer, uint64_t currentIndex, const uint64_t endIndex, IntegerVec& out);
+
+/**
+    @brief Decode the whole little endian doubles found between _currentIndex_ and _endIndex_ of _buffer_ with a single
+    copy and append them to _out_. Returns the index right past the last one, any trailing partial double is left.
+*/
+uint64_t decodePackedDoubles(const ByteSpan buffer, uint64_t currentIndex, const uint64_t endIndex, DoubleVec& out);
+
+/**
+    @brief Name of the packed varint kernel picked for this CPU ("avx2", "sse4.1" or "scalar")
+*/
+const char* getPackedVarIntKernelName();
+
+} // namespace hk
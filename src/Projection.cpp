@@ -0,0 +1,226 @@
+#include "Projection.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <string_view>
+
+#include "Utility.hpp"
+
+namespace hk
+{
+namespace
+{
+std::string_view trim(std::string_view str)
+{
+    constexpr std::string_view WHITESPACE{" \t\r\n"};
+    const auto first = str.find_first_not_of(WHITESPACE);
+    if (first == std::string_view::npos)
+    {
+        return {};
+    }
+    return str.substr(first, str.find_last_not_of(WHITESPACE) - first + 1);
+}
+
+/* Call _onPart_ with every trimmed piece of _str_ found between _separator_s */
+template <typename Callback> bool forEachPart(std::string_view str, const char separator, const Callback& onPart)
+{
+    while (true)
+    {
+        const auto end = str.find(separator);
+        if (!onPart(trim(str.substr(0, end))))
+        {
+            return false;
+        }
+        if (end == std::string_view::npos)
+        {
+            return true;
+        }
+        str.remove_prefix(end + 1);
+    }
+}
+} // namespace
+
+const Projection::FieldProjection* Projection::Node::getField(const uint64_t fieldNumber) const
+{
+    if (fieldNumber < fields.size())
+    {
+        const FieldProjection& field = fields[fieldNumber];
+        return field.keep ? &field : nullptr;
+    }
+
+    if (overflowFields.empty())
+    {
+        return nullptr;
+    }
+
+    const auto it = std::lower_bound(overflowFields.begin(), overflowFields.end(), fieldNumber,
+        [](const auto& entry, const uint64_t number) { return entry.first < number; });
+    if (it == overflowFields.end() || it->first != fieldNumber)
+    {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+const Projection::Node* Projection::Compiled::getClass(const std::string& className) const
+{
+    const auto it = classes.find(className);
+    return it != classes.end() ? it->second : nullptr;
+}
+
+bool Projection::parse(const std::string& spec)
+{
+    return forEachPart(spec, ';', [this](const std::string_view entry) { return addClass(std::string(entry)); });
+}
+
+bool Projection::loadFromFile(const std::filesystem::path& path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        printlne("Couldn't open projection file %s", path.c_str());
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (trim(line).starts_with('#'))
+        {
+            continue;
+        }
+        if (!parse(line))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Projection::empty() const
+{
+    return classes.empty();
+}
+
+bool Projection::wantsClass(const std::string& className) const
+{
+    return classes.contains(className);
+}
+
+std::shared_ptr<const Projection::Compiled> Projection::compile(const MetaSchema& schema) const
+{
+    auto compiled = std::make_shared<Compiled>();
+    for (const auto& [className, path] : classes)
+    {
+        /* Classes the meta doesn't know get reported by the decoder already */
+        const MetaSchema::MessageSchema* message = schema.getClass(className);
+        if (!message)
+        {
+            continue;
+        }
+        compiled->classes[className] = path.whole ? nullptr : compileNode(*message, path, *compiled);
+    }
+    return compiled;
+}
+
+bool Projection::addClass(const std::string& entry)
+{
+    /* Empty entries come out of trailing ';' and blank lines */
+    if (entry.empty())
+    {
+        return true;
+    }
+
+    const auto colon = entry.find(':');
+    const std::string className{trim(std::string_view(entry).substr(0, colon))};
+    if (className.empty())
+    {
+        printlne("Missing class name in projection \"%s\"", entry.c_str());
+        return false;
+    }
+
+    PathNode& classNode = classes[className];
+    if (colon == std::string::npos)
+    {
+        classNode.whole = true;
+        return true;
+    }
+
+    return forEachPart(std::string_view(entry).substr(colon + 1), ',',
+        [&classNode, &entry](const std::string_view fieldPath)
+        {
+            PathNode* node = &classNode;
+            const bool valid = !fieldPath.empty() && forEachPart(fieldPath, '.',
+                [&node](const std::string_view fieldName)
+                {
+                    if (fieldName.empty())
+                    {
+                        return false;
+                    }
+                    node = &node->children[std::string(fieldName)];
+                    return true;
+                });
+            if (!valid)
+            {
+                printlne("Malformed field path in projection \"%s\"", entry.c_str());
+                return false;
+            }
+            node->whole = true;
+            return true;
+        });
+}
+
+const Projection::Node* Projection::compileNode(const MetaSchema::MessageSchema& message,
+    const PathNode& path,
+    Compiled& out) const
+{
+    /* Deque, nodes handed out stay put while nested ones get added */
+    Node& node = out.nodes.emplace_back();
+
+    const auto projectField = [this, &path, &out](const MetaSchema::FieldDescriptor& field) -> FieldProjection
+    {
+        const auto it = path.children.find(field.name.str());
+        if (it == path.children.end())
+        {
+            return {};
+        }
+
+        /* Paths going deeper than a non struct field keep the whole field */
+        const PathNode& child = it->second;
+        const bool narrowed = !child.whole && field.type == MetaSchema::FieldType::STRUCT && field.nestedStruct;
+        return {.keep = true, .nested = narrowed ? compileNode(*field.nestedStruct, child, out) : nullptr};
+    };
+
+    for (uint64_t fieldNumber = 0; fieldNumber < message.fields.size(); fieldNumber++)
+    {
+        const MetaSchema::FieldDescriptor& field = message.fields[fieldNumber];
+        if (!field.isPresent)
+        {
+            continue;
+        }
+
+        const FieldProjection projected = projectField(field);
+        if (!projected.keep)
+        {
+            continue;
+        }
+        if (node.fields.size() <= fieldNumber)
+        {
+            node.fields.resize(fieldNumber + 1);
+        }
+        node.fields[fieldNumber] = projected;
+    }
+
+    /* Already sorted by field number */
+    for (const auto& [fieldNumber, field] : message.overflowFields)
+    {
+        const FieldProjection projected = projectField(field);
+        if (projected.keep)
+        {
+            node.overflowFields.emplace_back(fieldNumber, projected);
+        }
+    }
+    return &node;
+}
+
+} // namespace hk
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "MetaSchema.hpp"
+
+namespace hk
+{
+
+/* Classes and field paths the user cares about. Written as "Class[:field[.nested...][,field...]][;Class...]", a
+   class without fields keeps all of them. Changes of other classes are dropped before decoding and unrequested
+   fields are skipped over by wire type without being looked up in the schema. */
+class Projection
+{
+public:
+    /* What to do with a field of a projected message */
+    struct Node;
+    struct FieldProjection
+    {
+        bool keep{false};
+        /* Fields to keep inside a struct field, nullptr keeps all of them */
+        const Node* nested{nullptr};
+    };
+
+    /* Projection of a message resolved against a schema, indexed by field number like MessageSchema */
+    struct Node
+    {
+        std::vector<FieldProjection> fields;
+        std::vector<std::pair<uint64_t, FieldProjection>> overflowFields;
+
+        /**
+            @brief Get what to do with _fieldNumber_ or nullptr if it should be skipped
+        */
+        const FieldProjection* getField(const uint64_t fieldNumber) const;
+    };
+
+    /* Projection resolved against one meta schema, only valid along with that schema */
+    class Compiled
+    {
+    public:
+        /**
+            @brief Get the field projection of _className_. nullptr means every field is wanted.
+        */
+        const Node* getClass(const std::string& className) const;
+
+    private:
+        friend class Projection;
+        std::deque<Node> nodes;
+        std::unordered_map<std::string, const Node*> classes;
+    };
+
+    /**
+        @brief Add the classes and fields of _spec_. Returns false (and prints why) on malformed specs.
+    */
+    bool parse(const std::string& spec);
+
+    /**
+        @brief Same as parse for the contents of the file at _path_, one or more classes per line. Lines starting
+        with '#' are comments.
+    */
+    bool loadFromFile(const std::filesystem::path& path);
+
+    bool empty() const;
+
+    bool wantsClass(const std::string& className) const;
+
+    /**
+        @brief Resolve field names to field numbers using _schema_. Fields the schema doesn't know are ignored.
+    */
+    std::shared_ptr<const Compiled> compile(const MetaSchema& schema) const;
+
+private:
+    struct PathNode
+    {
+        /* Set when the whole field (or class) is wanted, whatever got listed below it */
+        bool whole{false};
+        std::map<std::string, PathNode> children;
+    };
+
+    bool addClass(const std::string& entry);
+
+    const Node* compileNode(const MetaSchema::MessageSchema& message, const PathNode& path, Compiled& out) const;
+
+private:
+    std::unordered_map<std::string, PathNode> classes;
+};
+
+} // namespace hk
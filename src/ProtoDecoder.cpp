@@ -1,22 +1,25 @@
 #include "ProtoDecoder.hpp"
 
 #include "CommonTypes.hpp"
+#include "PackedDecoding.hpp"
 #include "Utility.hpp"
+#include <algorithm>
+#include <bit>
 #include <cstdint>
-#include <mutex>
+#include <deque>
 #include <string>
 #include <variant>
 
 namespace hk
 {
-FieldMap ProtobufDecoder::parseProtobufFromBuffer(const XMLDecoder::XmlResult& firstXML,
-    const XMLDecoder::XmlResult& secondXML,
+FieldMap ProtobufDecoder::parseProtobufFromBuffer(const MetaSchema& schema,
     const std::string& objectClassName,
-    const std::vector<uint8_t>& buffer)
+    const ByteSpan buffer,
+    std::pmr::memory_resource* resource,
+    const Projection::Node* projection)
 {
     uint64_t currentIndex{0};
     uint64_t bufferSize = buffer.size();
-    XMLDecoder::NodeSPtr objectNode{nullptr};
 
     /* Ignore objects with non-standard meta structures */
     if (objectClassName.contains("GNSS") || objectClassName.contains("CLOCK") || objectClassName.contains("NTP") ||
@@ -25,79 +28,96 @@ FieldMap ProtobufDecoder::parseProtobufFromBuffer(const XMLDecoder::XmlResult& f
         return {};
     }
 
-    /* Check the cache first */
-    objectsMapLock.lock();
-    metaVersion = secondXML.first[0]->nodeName == "?xml" ? 1 : 0;
-    if (objectsMap.contains(objectClassName))
+    /* Schema is immutable once loaded, no locking needed */
+    const MetaSchema::MessageSchema* objectSchema = schema.getClass(objectClassName);
+    if (!objectSchema)
     {
-        objectNode = objectsMap[objectClassName];
-        objectsMapLock.unlock();
-    }
-    /* Else do the hard work of finding it */
-    else
-    {
-        objectsMapLock.unlock();
-        const XMLDecoder::AttrPair searchAttr{"class", objectClassName};
-        objectNode = firstXML.first[metaVersion]->getTagNamedWithAttrib("managedObject", searchAttr);
-        if (!objectNode)
-        {
-            objectNode = secondXML.first[metaVersion]->getTagNamedWithAttrib("managedObject", searchAttr);
-            if (!objectNode)
-            {
-                printlne("Couldn't find object named %s nowhere", objectClassName.c_str());
-                return {};
-            }
-        }
-
-        objectsMapLock.lock();
-        objectsMap[objectClassName] = objectNode;
-        objectsMapLock.unlock();
-    }
-
-    FieldMap fieldsMap;
-    while (currentIndex < bufferSize)
-    {
-        resolveTopLevelDecodeResult(fieldsMap, decode(objectNode, buffer, currentIndex));
+        printlne("Couldn't find object named %s nowhere", objectClassName.c_str());
+        return {};
     }
 
-    return fieldsMap;
+    return decodeMessage(*objectSchema, projection, buffer, currentIndex, bufferSize, resource);
 }
 
-std::vector<FieldMap> ProtobufDecoder::parseProtobuffs(const XMLDecoder::XmlResult& firstXML,
-    const XMLDecoder::XmlResult& secondXML,
+std::vector<FieldMap> ProtobufDecoder::parseProtobuffs(const MetaSchema& schema,
     const std::vector<std::string>& objectClassNames,
-    const std::vector<std::vector<uint8_t>>& buffers)
+    const std::vector<ByteSpan>& buffers,
+    std::pmr::memory_resource* resource,
+    const Projection::Compiled* projection)
 {
-    std::vector<FieldMap> results;
-    futures.reserve(buffers.size());
+    /* Every task gets a slot of its own, so workers write their result in place without any synchronization.
+       Results are moved in, so they keep living in _resource_. */
+    std::vector<FieldMap> results(buffers.size());
 
     // for (uint64_t index = 0; const auto& objCn : objectClassNames)
     // {
-    //     results.emplace_back(parseProtobufFromBuffer(firstXML, secondXML, objCn, buffers[index++]));
+    //     results.emplace_back(parseProtobufFromBuffer(schema, objCn, buffers[index++]));
     // }
 
-    for (uint64_t index = 0; const auto& objCn : objectClassNames)
+    /* Size batches by payload bytes rather than by change count, a handful of big objects can outweigh thousands
+       of small ones. Tiny inputs end up as a single batch, small batches are never worth a task of their own. */
+    uint64_t totalBytes{0};
+    for (const auto& buffer : buffers)
     {
-        // clang-format off
-        futures.emplace_back(
-            tp.enqueue(
-                std::bind(
-                    &ProtobufDecoder::parseProtobufFromBuffer, this,
-                    firstXML, secondXML, objCn, buffers[index++]
-                    )));
-        // clang-format on
+        totalBytes += buffer.size();
     }
-
-    for (auto& future : futures)
+    const uint64_t batchBytes = std::clamp<uint64_t>(totalBytes / (pool->getThreadCount() * TASKS_PER_WORKER),
+        MIN_BATCH_BYTES, MAX_BATCH_BYTES);
+
+    /* [first, last) ranges of buffers */
+    std::vector<std::pair<uint64_t, uint64_t>> batches;
+    uint64_t batchStart{0};
+    uint64_t currentBatchBytes{0};
+    for (uint64_t index = 0; index < buffers.size(); index++)
+    {
+        currentBatchBytes += buffers[index].size();
+        if (currentBatchBytes >= batchBytes)
+        {
+            batches.emplace_back(batchStart, index + 1);
+            batchStart = index + 1;
+            currentBatchBytes = 0;
+        }
+    }
+    if (batchStart < buffers.size())
     {
-        results.emplace_back(future.get());
+        batches.emplace_back(batchStart, buffers.size());
     }
 
-    futures.clear();
+    const auto decodeBatch = [this, &schema, &objectClassNames, &buffers, &results, resource, projection](
+                                 const uint64_t first, const uint64_t last)
+    {
+        for (uint64_t index = first; index < last; index++)
+        {
+            const Projection::Node* fields = projection ? projection->getClass(objectClassNames[index]) : nullptr;
+            results[index] =
+                parseProtobufFromBuffer(schema, objectClassNames[index], buffers[index], resource, fields);
+        }
+    };
+
+    /* Even a single batch goes to the pool, the calling thread never decodes itself so that only the configured
+       number of threads ever do. Inputs are only read while tasks run and outlive them (we wait below), so tasks
+       just carry the range of changes they decode. Completion is tracked by a single task group instead of one
+       future per change. */
+    WorkStealingPool::TaskGroup group;
+    for (const auto& [first, last] : batches)
+    {
+        pool->submit(group, [&decodeBatch, first, last]() { decodeBatch(first, last); });
+    }
+    pool->wait(group);
 
     return results;
 }
 
+void ProtobufDecoder::setZeroCopy(const bool enabled)
+{
+    zeroCopy = enabled;
+}
+
+void ProtobufDecoder::setThreadCount(const uint32_t threadCount)
+{
+    pool = std::make_unique<WorkStealingPool>(threadCount);
+}
+
 void ProtobufDecoder::printFields(const FieldMap& fm, uint64_t depth)
 {
     std::string sp;
@@ -117,10 +137,16 @@ void ProtobufDecoder::printFields(const FieldMap& fm, uint64_t depth)
         {
             println("%sFieldName: %s: FieldValue: %lf", sp.c_str(), fieldName.c_str(), std::get<double>(field));
         }
-        else if (std::holds_alternative<std::string>(field))
+        else if (std::holds_alternative<std::pmr::string>(field))
         {
             println("%sFieldName: %s FieldValue: %s", sp.c_str(), fieldName.c_str(),
-                std::get<std::string>(field).c_str());
+                std::get<std::pmr::string>(field).c_str());
+        }
+        else if (std::holds_alternative<std::string_view>(field))
+        {
+            const std::string_view& value = std::get<std::string_view>(field);
+            println("%sFieldName: %s FieldValue: %.*s", sp.c_str(), fieldName.c_str(), (int32_t)value.size(),
+                value.data());
         }
         else if (std::holds_alternative<StringVec>(field))
         {
@@ -165,82 +191,115 @@ void ProtobufDecoder::printFields(const FieldMap& fm, uint64_t depth)
 
 // Protobuf decoding related //
 
-ProtobufDecoder::DecodeResult ProtobufDecoder::decode(const XMLDecoder::NodeSPtr& objectNode,
-    const std::vector<uint8_t>& buffer,
-    uint64_t& currentIndex)
+FieldMap ProtobufDecoder::decodeMessage(const MetaSchema::MessageSchema& message,
+    const Projection::Node* projection,
+    const ByteSpan buffer,
+    uint64_t& currentIndex,
+    const uint64_t endIndex,
+    std::pmr::memory_resource* resource)
 {
-    /* Decoded result to be returned. Since it's a variant, it can have int/double/string/[] forms */
-    DecodeResult decodeResult;
+    /* Nested structs big enough to be worth it get decoded as subtasks that idle workers can steal. Their place in
+       the parent is reserved now and filled in once the parent has been walked entirely. Deque so that running
+       subtasks keep writing to the same place while more get added. */
+    struct Subtask
+    {
+        FieldName name;
+        uint64_t slot{0};
+        FieldMap result;
+    };
+    std::deque<Subtask> subtasks;
+    WorkStealingPool::TaskGroup group;
+
+    FieldMap fieldsMap{resource};
+    while (currentIndex < endIndex)
+    {
+        DeferredStruct deferred;
+        DecodeResult decodeResult = decode(message, projection, buffer, currentIndex, endIndex, resource, &deferred);
+        resolveTopLevelDecodeResult(fieldsMap, decodeResult, resource);
+        if (!deferred.message)
+        {
+            continue;
+        }
 
-    TagDecodeResult tagResult = decodeTag(buffer, currentIndex);
+        /* Struct values always end up in a FieldMapVec, the placeholder is the last one in there */
+        Subtask& subtask = subtasks.emplace_back();
+        subtask.name = decodeResult.name;
+        subtask.slot = std::get<FieldMapVec>(fieldsMap[decodeResult.name]).size() - 1;
+        pool->submit(group,
+            [this, &subtask, deferred, buffer, resource]()
+            {
+                uint64_t subtaskIndex{deferred.begin};
+                subtask.result = decodeMessage(*deferred.message, deferred.projection, buffer, subtaskIndex,
+                    deferred.end, resource);
+            });
+    }
 
-    /* We need to find inside the children of "objectNode" a "p" or "action" node who's "proto" node attribute
-     * "index" is equal to tagResult.fieldNumber. This will tell us a lot about what kind of node we are dealing
-     * with. Alternatively we need to find the "p" or "action" node who's "id" is equal to tagResult.fieldNumber. */
-    /* Keep track at which position relative to other "objectNode" children we found this "p" or "action" node. */
-    XMLDecoder::NodeSPtr pOrActionNode{nullptr};
-    int64_t pOrActionNodeIndex{0};
+    if (subtasks.empty())
+    {
+        return fieldsMap;
+    }
 
-    for (const auto& objectNodeChild : objectNode->children)
+    pool->wait(group);
+    for (auto& subtask : subtasks)
     {
-        if (objectNodeChild->nodeName == "p" || objectNodeChild->nodeName == "action")
+        /* Malformed payloads could have overwritten the field with something else since */
+        FieldValue& field = fieldsMap[subtask.name];
+        if (std::holds_alternative<FieldMapVec>(field) && subtask.slot < std::get<FieldMapVec>(field).size())
         {
-            const uint64_t childrenCount = objectNodeChild->children.size();
+            std::get<FieldMapVec>(field)[subtask.slot] = std::move(subtask.result);
+        }
+    }
+    return fieldsMap;
+}
 
-            /* "proto" will always be the last node.. except for the meta version in which "proto" in BM is not
-               present and we need to check the "id" attribute instead. */
-            std::string indexValue;
-            if (childrenCount == 0 || objectNodeChild->children[childrenCount - 1]->nodeName != "proto")
-            {
-                indexValue = objectNodeChild->getAttribValue("id").value_or("0");
-            }
-            else
-            {
-                const XMLDecoder::NodeSPtr protoNode = objectNodeChild->children[childrenCount - 1];
-                indexValue = protoNode->getAttribValue("index").value_or("0");
-            }
+ProtobufDecoder::DecodeResult ProtobufDecoder::decode(const MetaSchema::MessageSchema& message,
+    const Projection::Node* projection,
+    const ByteSpan buffer,
+    uint64_t& currentIndex,
+    const uint64_t endIndex,
+    std::pmr::memory_resource* resource,
+    DeferredStruct* deferred)
+{
+    /* Decoded result to be returned. Since it's a variant, it can have int/double/string/[] forms */
+    DecodeResult decodeResult;
 
-            /* The decoded field name is the "name" attribute of the "p" / "action" node. */
-            if (indexValue == std::to_string(tagResult.fieldNumber))
-            {
-                pOrActionNode = objectNodeChild;
-                const std::string fieldName = pOrActionNode->getAttribValue("name").value_or("??");
-                decodeResult.name = fieldName;
-                // printlne("%s %s name: %s", objectNode->getAttribValue("class")->c_str(),
-                //     std::to_string(tagResult.fieldNumber).c_str(), fieldName.c_str());
-                break;
-            }
+    TagDecodeResult tagResult = decodeTag(buffer, currentIndex);
+
+    /* Fields left out of the projection are stepped over by wire type before the schema is even looked at.
+       Returning no name makes the caller drop the result. */
+    const Projection::FieldProjection* fieldProjection{nullptr};
+    if (projection)
+    {
+        fieldProjection = projection->getField(tagResult.fieldNumber);
+        if (!fieldProjection)
+        {
+            skipPayload(tagResult, buffer, currentIndex, endIndex);
+            return {};
         }
-        pOrActionNodeIndex++;
     }
+    const Projection::Node* nestedProjection = fieldProjection ? fieldProjection->nested : nullptr;
+
+    /* The compiled schema already knows which "p"/"action" node describes this field number. */
+    const MetaSchema::FieldDescriptor* field = message.getField(tagResult.fieldNumber);
 
     /* If we get inside here, means we did something wrong. There always needs to be a p/action node for a tag field
-       number. In this case some error should be shown.*/
-    if (!pOrActionNode)
+       number. In this case some error should be shown and the payload skipped so the next tag can be read.*/
+    if (!field)
     {
         printlne("pOrActionNode not found for fieldNumber %ld", tagResult.fieldNumber);
+        skipPayload(tagResult, buffer, currentIndex, endIndex);
         return {};
     }
 
-    /* If p/action nodes can have "recurrence" and "type" attributes. Based on those, we need to decide how to decode
-       further.*/
-    const std::string pNodeType = pOrActionNode->getAttribValue("type").value_or("UNKNOWN");
-    const std::string pNodeRecurrence = pOrActionNode->getAttribValue("recurrence").value_or("UNKNOWN");
-    const bool isIntegerType = pNodeType == "integer";
-    const bool isDoubleType = pNodeType == "double";
-    const bool isStringType = pNodeType == "string";
-    const bool isSimpleType = isIntegerType || isDoubleType || pNodeType == "boolean";
-    const bool isFieldRepeated = pNodeRecurrence == "repeated";
+    decodeResult.name = field->name;
+    decodeResult.isRepeated = field->isRepeated;
 
-    const bool isPackedData =
-        (metaVersion == META_VERSION_TOP_NO_XML && isFieldRepeated) ||
-        (isFieldRepeated &&
-            pOrActionNode->children[pOrActionNode->children.size() - 1]->getAttribValue("packed").value_or("?") ==
-                "true");
-    if (isFieldRepeated)
-    {
-        decodeResult.isRepeated = true;
-    }
+    /* Type, recurrence and packing were resolved at compile time. Based on those, we need to decide how to decode
+       further.*/
+    const bool isIntegerType = field->type == MetaSchema::FieldType::INTEGER;
+    const bool isDoubleType = field->type == MetaSchema::FieldType::DOUBLE;
+    const bool isSimpleType = isIntegerType || isDoubleType || field->type == MetaSchema::FieldType::BOOLEAN;
+    const bool isPackedData = field->isPacked;
 
     if (isSimpleType)
     {
@@ -256,14 +315,10 @@ ProtobufDecoder::DecodeResult ProtobufDecoder::decode(const XMLDecoder::NodeSPtr
         {
             hint = DecodeHint::PACKED_ENUM;
         }
-        else if (isStringType)
-        {
-            hint = DecodeHint::STRING_OR_BYTES;
-        }
 
-        /* As this isn't a structure of any kind, we can pass "nullptr" as first argument. No need to recurse
+        /* As this isn't a structure of any kind, we can pass "nullptr" as first arguments. No need to recurse
            deeper. Decode will always get us an integer/double/bool. No hints are necessary here. */
-        FieldValue decodedPayload = decodePayload(nullptr, tagResult, buffer, hint, currentIndex);
+        FieldValue decodedPayload = decodePayload(nullptr, nullptr, tagResult, buffer, hint, currentIndex, resource);
 
         /* In the future we can adapt "decodePayload" to automatically give back a double based on hint, but for
         now, we need to cast it outselves from int -> double. */
@@ -275,107 +330,179 @@ ProtobufDecoder::DecodeResult ProtobufDecoder::decode(const XMLDecoder::NodeSPtr
         }
         else
         {
-            decodeResult.field.second = decodedPayload;
+            decodeResult.field.second = std::move(decodedPayload);
         }
 
         /* Nothing to be done. Proceed to next tag-value pair.*/
         return decodeResult;
     }
-    else if (isStringType)
+    else if (field->type == MetaSchema::FieldType::STRING)
     {
         /* We can still pass "nullptr" as we don't need to recurse down on anything, but the hint is now set as
            this is a special LEN decoding path. */
-        FieldValue decodedPayload = decodePayload(nullptr, tagResult, buffer, DecodeHint::STRING_OR_BYTES,
-            currentIndex);
-        decodeResult.field.second = decodedPayload;
+        FieldValue decodedPayload = decodePayload(nullptr, nullptr, tagResult, buffer, DecodeHint::STRING_OR_BYTES,
+            currentIndex, resource);
+        decodeResult.field.second = std::move(decodedPayload);
 
         /* Nothing to be done. Proceed to next tag-value pair.*/
         return decodeResult;
     }
-    else // enums/structs
+    else if (field->type == MetaSchema::FieldType::ENUMERATION)
     {
-        /* We need to recurse down on the object one above "p"/"action" node. However if that node doesn't
-           exist, we kinda have a problem. We shall not get to this point. Some objects don't follow the META
-           correctly and we will end up here. Skip for those (GNSS). No need to recurse for enums though. */
-        if (pOrActionNodeIndex - 1 < 0)
-        {
-            printlne("One above index is less than zero!");
-            return decodeResult;
-        }
+        decodeResult.field.second = decodePayload(&message, nullptr, tagResult, buffer,
+            isPackedData ? DecodeHint::PACKED_ENUM : DecodeHint::NONE, currentIndex, resource);
 
-        if (pOrActionNodeIndex - 1 >= 0 && objectNode->children[pOrActionNodeIndex - 1]->nodeName == "enumeration")
+        /* Enum names come straight out of the precomputed table. On unknown values the raw numbers are kept. */
+        const MetaSchema::EnumTable& enumeration = *field->enumeration;
+        if (std::holds_alternative<IntegerVec>(decodeResult.field.second))
         {
-            FieldValue decodedPayload = decodePayload(objectNode, tagResult, buffer,
-                isPackedData ? DecodeHint::PACKED_ENUM : DecodeHint::NONE, currentIndex);
-            decodeResult.field.second = decodedPayload;
-
-            XMLDecoder::NodeSPtr nodeAbovePNode = objectNode->children[pOrActionNodeIndex - 1];
-            if (std::holds_alternative<IntegerVec>(decodedPayload))
+            const IntegerVec& enumValues = std::get<IntegerVec>(decodeResult.field.second);
+            StringVec sv{resource};
+            sv.reserve(enumValues.size());
+            for (const uint64_t& i : enumValues)
             {
-                StringVec sv;
-                for (const uint64_t& i : std::get<IntegerVec>(decodedPayload))
+                const std::string* enumName = enumeration.getName(i);
+                if (!enumName)
                 {
-                    const XMLDecoder::NodeSPtr& enumNode = nodeAbovePNode->getTagNamedWithAttrib("enum",
-                        {"value", std::to_string(i)});
-                    if (!enumNode)
-                    {
-                        printlne("Didn't find any enum matching description %ld", i);
-                        return decodeResult;
-                    }
-
-                    std::string decodedEnumVal = enumNode->getAttribValue("name").value_or("VALUE_NOT_FOUND");
-                    sv.emplace_back(decodedEnumVal);
+                    printlne("Didn't find any enum matching description %ld", i);
+                    return decodeResult;
                 }
-                decodeResult.field.second = sv;
+                sv.emplace_back(*enumName);
+            }
+            decodeResult.field.second = std::move(sv);
+        }
+        else
+        {
+            uint64_t enumVal = std::get<uint64_t>(decodeResult.field.second);
+            const std::string* enumName = enumeration.getName(enumVal);
+            if (!enumName)
+            {
+                printlne("Didn't find any enum matching description %ld", enumVal);
+                return decodeResult;
+            }
+            if (zeroCopy)
+            {
+                decodeResult.field.second = std::string_view(*enumName);
             }
             else
             {
-                uint64_t enumVal = std::get<uint64_t>(decodeResult.field.second);
-                const XMLDecoder::NodeSPtr& enumNode = nodeAbovePNode->getTagNamedWithAttrib("enum",
-                    {"value", std::to_string(enumVal)});
-
-                if (!enumNode)
-                {
-                    printlne("Didn't find any enum matching description %ld", enumVal);
-                    return decodeResult;
-                }
-                decodeResult.field.second = enumNode->getAttribValue("name").value_or("VALUE_NOT_FOUND");
+                decodeResult.field.second = std::pmr::string(*enumName, resource);
             }
+        }
 
-            /* Nothing to be done. Proceed to next tag-value pair.*/
-            return decodeResult;
-        } // enum
+        /* Nothing to be done. Proceed to next tag-value pair.*/
+        return decodeResult;
+    }
+    else if (field->type == MetaSchema::FieldType::STRUCT)
+    {
+        /* Big structs are left for the caller to decode as a subtask. Only an empty placeholder goes in for now. */
+        if (deferred && field->nestedStruct && tagResult.type == WireType::LEN)
+        {
+            uint64_t payloadIndex{currentIndex};
+            const uint64_t payloadLen = decodeVarInt(buffer, payloadIndex);
+            if (payloadLen >= SUBTASK_MIN_BYTES && payloadLen <= buffer.size() - payloadIndex)
+            {
+                *deferred = {.message = field->nestedStruct,
+                    .projection = nestedProjection,
+                    .begin = payloadIndex,
+                    .end = payloadIndex + payloadLen};
+                currentIndex = payloadIndex + payloadLen;
+                decodeResult.field.second = FieldMap{};
+                return decodeResult;
+            }
+        }
 
-        /* This object is gonna play as the struct above the "p"/"action" node from where we will get our
+        /* The nested struct table plays as the struct above the "p"/"action" node from where we will get our
            next values. We are nesting.*/
-        XMLDecoder::NodeSPtr nodeAbovePNode = objectNode->children[pOrActionNodeIndex - 1];
-        FieldValue decodedPayload = decodePayload(nodeAbovePNode, tagResult, buffer, DecodeHint::NONE, currentIndex);
-        decodeResult.field.second = decodedPayload;
+        decodeResult.field.second = decodePayload(field->nestedStruct, nestedProjection, tagResult, buffer,
+            DecodeHint::NONE, currentIndex, resource);
 
         /* Nothing to be done. Proceed to next tag-value pair.*/
         return decodeResult;
     }
+
+    /* Some objects don't follow the META correctly and we will end up here (GNSS). There's no node above the
+       "p"/"action" node to recurse into, so skip over the payload. */
+    printlne("One above index is less than zero!");
+    skipPayload(tagResult, buffer, currentIndex, endIndex);
     return decodeResult;
 }
 
-void ProtobufDecoder::resolveTopLevelDecodeResult(FieldMap& fieldMap, const DecodeResult& decodeResult)
+void ProtobufDecoder::skipPayload(const TagDecodeResult& decodedTag,
+    const ByteSpan buffer,
+    uint64_t& currentIndex,
+    const uint64_t endIndex)
+{
+    /* Never step past the enclosing message. Malformed lengths would otherwise wrap the index around and have the
+       caller read the same bytes over and over. */
+    const uint64_t limit = std::min<uint64_t>(endIndex, buffer.size());
+    uint64_t skipBytes{0};
+    switch (decodedTag.type)
+    {
+        case WireType::VARINT:
+            decodeVarInt(buffer, currentIndex);
+            break;
+        case WireType::I64:
+            skipBytes = 8;
+            break;
+        case WireType::LEN:
+            skipBytes = decodeVarInt(buffer, currentIndex);
+            break;
+        case WireType::I32:
+            skipBytes = 4;
+            break;
+        default:
+            /* Nothing sane to skip, make the caller stop at the end of the message. */
+            currentIndex = std::max(currentIndex, limit);
+            return;
+    }
+
+    if (currentIndex > limit || skipBytes > limit - currentIndex)
+    {
+        printlne("Skipped payload of %lu bytes goes past the end of the message", skipBytes);
+        currentIndex = std::max(currentIndex, limit);
+        return;
+    }
+    currentIndex += skipBytes;
+}
+
+void ProtobufDecoder::resolveTopLevelDecodeResult(FieldMap& fieldMap,
+    DecodeResult& decodeResult,
+    std::pmr::memory_resource* resource)
 {
-    const auto& [fieldName, repeated, decodedField] = decodeResult;
+    /* Decoded values get moved in, copies would leave the memory resource they were decoded into */
+    auto& [fieldName, repeated, decodedField] = decodeResult;
+
+    /* Fields unknown to the schema have been skipped, there's nothing to store */
+    if (fieldName.empty())
+    {
+        return;
+    }
+
     auto& field = fieldMap[fieldName];
 
-    if (std::holds_alternative<std::string>(decodedField.second) && repeated)
+    if (std::holds_alternative<std::pmr::string>(decodedField.second) && repeated)
+    {
+        if (!std::holds_alternative<StringVec>(field))
+        {
+            field = StringVec{resource};
+        }
+        std::get<StringVec>(field).emplace_back(std::move(std::get<std::pmr::string>(decodedField.second)));
+    }
+    else if (std::holds_alternative<std::string_view>(decodedField.second) && repeated)
     {
+        /* Repeated strings are rare enough that they're still collected as owned copies */
         if (!std::holds_alternative<StringVec>(field))
         {
-            field = StringVec{};
+            field = StringVec{resource};
         }
-        std::get<StringVec>(field).emplace_back(std::get<std::string>(decodedField.second));
+        std::get<StringVec>(field).emplace_back(std::get<std::string_view>(decodedField.second));
     }
     else if (std::holds_alternative<uint64_t>(decodedField.second) && repeated)
     {
         if (!std::holds_alternative<IntegerVec>(field))
         {
-            field = IntegerVec{};
+            field = IntegerVec{resource};
         }
         std::get<IntegerVec>(field).emplace_back(std::get<uint64_t>(decodedField.second));
     }
@@ -383,7 +510,7 @@ void ProtobufDecoder::resolveTopLevelDecodeResult(FieldMap& fieldMap, const Deco
     {
         if (!std::holds_alternative<DoubleVec>(field))
         {
-            field = DoubleVec{};
+            field = DoubleVec{resource};
         }
         std::get<DoubleVec>(field).emplace_back(std::get<double>(decodedField.second));
     }
@@ -394,29 +521,35 @@ void ProtobufDecoder::resolveTopLevelDecodeResult(FieldMap& fieldMap, const Deco
         {
             if (!std::holds_alternative<FieldMapVec>(field))
             {
-                field = FieldMapVec{};
+                field = FieldMapVec{resource};
             }
-            std::get<FieldMapVec>(field).emplace_back(std::get<FieldMap>(decodedField.second));
+            std::get<FieldMapVec>(field).emplace_back(std::move(std::get<FieldMap>(decodedField.second)));
             // printlne("size is %ld", std::get<FieldMapVec>(field).s);
         }
         else
         {
-            fieldMap[fieldName] = decodedField.second;
+            fieldMap[fieldName] = std::move(decodedField.second);
         }
     }
     else
     {
         // printlne("else? repeated: %d", repeated);
-        field = decodedField.second;
+        field = std::move(decodedField.second);
     }
 }
 
-uint64_t ProtobufDecoder::decodeVarInt(const std::vector<uint8_t>& buffer, uint64_t& currentIndex)
+uint64_t ProtobufDecoder::decodeVarInt(const ByteSpan buffer, uint64_t& currentIndex)
 {
+    /* Tags, enums and small numbers fit a single byte, no need to go through the loop for those */
+    if (currentIndex < buffer.size() && !(buffer[currentIndex] & 0b10000000))
+    {
+        return buffer[currentIndex++];
+    }
+
     uint64_t result{0};
     uint8_t byteCount{0};
     uint8_t varintPart{0};
-    while (true)
+    while (currentIndex < buffer.size())
     {
         varintPart = buffer[currentIndex++];
         /* Construct the number (left to right)
@@ -438,21 +571,26 @@ uint64_t ProtobufDecoder::decodeVarInt(const std::vector<uint8_t>& buffer, uint6
     return result;
 }
 
-uint64_t ProtobufDecoder::decodeNumber64(const std::vector<uint8_t>& buffer, uint64_t& currentIndex)
+uint64_t ProtobufDecoder::decodeNumber64(const ByteSpan buffer, uint64_t& currentIndex)
 {
-    /* Similar to decodeVarint but this is fixed 64bit number. No need for guessing if there's another byte. */
+    /* Similar to decodeVarint but this is fixed 64bit little endian number. No need for guessing if there's another
+       byte. */
     uint64_t result{0};
-    uint8_t byteCount{0};
-    uint8_t numberPart{0};
 
     const int8_t BYTES_8 = 8;
-    while (byteCount < BYTES_8)
+    if (buffer.size() - currentIndex < BYTES_8)
     {
-        numberPart = buffer[currentIndex++];
+        printlne("Fixed 64 bit number goes past the end of the payload");
+        currentIndex = buffer.size();
+        return result;
+    }
 
-        result |= (uint64_t)(numberPart) << (8 * byteCount);
-        ++byteCount;
+    std::memcpy(&result, buffer.data() + currentIndex, sizeof(result));
+    if constexpr (std::endian::native == std::endian::big)
+    {
+        result = __builtin_bswap64(result);
     }
+    currentIndex += BYTES_8;
     return result;
 }
 
@@ -476,7 +614,7 @@ std::string ProtobufDecoder::getTagString(const TagDecodeResult& tag)
     return "UNKNOWN";
 }
 
-ProtobufDecoder::TagDecodeResult ProtobufDecoder::decodeTag(const std::vector<uint8_t>& buffer, uint64_t& currentIndex)
+ProtobufDecoder::TagDecodeResult ProtobufDecoder::decodeTag(const ByteSpan buffer, uint64_t& currentIndex)
 {
     uint8_t tag = buffer[currentIndex++];
 
@@ -507,23 +645,24 @@ ProtobufDecoder::TagDecodeResult ProtobufDecoder::decodeTag(const std::vector<ui
     return {.type = type, .fieldNumber = fieldNumber};
 }
 
-std::string
-ProtobufDecoder::decodePackedPayload(const uint64_t len, const std::vector<uint8_t>& buffer, uint64_t& currentIndex)
+std::pmr::string ProtobufDecoder::decodePackedPayload(const uint64_t len,
+    const ByteSpan buffer,
+    uint64_t& currentIndex,
+    std::pmr::memory_resource* resource)
 {
     /* Construct string from the next LEN bytes. No need to return bytesRead as it is already known. */
-    std::string result(len, '\0');
-    for (uint64_t i = 0; i < len; ++i)
-    {
-        result[i] = buffer[currentIndex++];
-    }
+    std::pmr::string result(reinterpret_cast<const char*>(buffer.data() + currentIndex), len, resource);
+    currentIndex += len;
     return result;
 }
 
-FieldValue ProtobufDecoder::decodePayload(const XMLDecoder::NodeSPtr& objectNode,
+FieldValue ProtobufDecoder::decodePayload(const MetaSchema::MessageSchema* message,
+    const Projection::Node* projection,
     const TagDecodeResult& decodedTag,
-    const std::vector<uint8_t>& buffer,
+    const ByteSpan buffer,
     const DecodeHint hint,
-    uint64_t& currentIndex)
+    uint64_t& currentIndex,
+    std::pmr::memory_resource* resource)
 {
     switch (decodedTag.type)
     {
@@ -541,14 +680,31 @@ FieldValue ProtobufDecoder::decodePayload(const XMLDecoder::NodeSPtr& objectNode
         case WireType::LEN: {
             /* Decoded length of the LEN payload in bytes*/
             uint64_t payloadLen = decodeVarInt(buffer, currentIndex);
-            if (hint == DecodeHint::STRING_OR_BYTES)
+            if (payloadLen > buffer.size() - currentIndex)
             {
-                return decodePackedPayload(payloadLen, buffer, currentIndex);
+                printlne("LEN payload of %lu bytes goes past the end of the payload", payloadLen);
+                currentIndex = buffer.size();
+                return {};
+            }
+
+            if (hint == DecodeHint::STRING_OR_BYTES && zeroCopy)
+            {
+                /* View straight into the frame buffer, the owning frame keeps it alive */
+                std::string_view result(reinterpret_cast<const char*>(buffer.data() + currentIndex), payloadLen);
+                currentIndex += payloadLen;
+                return result;
+            }
+            else if (hint == DecodeHint::STRING_OR_BYTES)
+            {
+                return decodePackedPayload(payloadLen, buffer, currentIndex, resource);
             }
             else if (hint == DecodeHint::PACKED_DOUBLE)
             {
-                DoubleVec doubleVec;
+                DoubleVec doubleVec{resource};
                 const uint64_t maxToRead{currentIndex + payloadLen};
+                currentIndex = decodePackedDoubles(buffer, currentIndex, maxToRead, doubleVec);
+
+                /* Only a malformed payload leaves a partial double behind */
                 while (currentIndex < maxToRead)
                 {
                     uint64_t decodedVarint = decodeNumber64(buffer, currentIndex);
@@ -560,24 +716,19 @@ FieldValue ProtobufDecoder::decodePayload(const XMLDecoder::NodeSPtr& objectNode
             }
             else if (hint == DecodeHint::PACKED_ENUM)
             {
-                IntegerVec integerVec;
-                const uint64_t maxToRead{currentIndex + payloadLen};
-                while (currentIndex < maxToRead)
-                {
-                    uint64_t decodedVarint = decodeVarInt(buffer, currentIndex);
-                    integerVec.emplace_back(decodedVarint);
-                }
+                IntegerVec integerVec{resource};
+                currentIndex = decodePackedVarInts(buffer, currentIndex, currentIndex + payloadLen, integerVec);
                 return integerVec;
             }
+            else if (!message)
+            {
+                printlne("No struct to decode LEN payload into. Skip");
+                currentIndex += payloadLen;
+                return {};
+            }
             else
             {
-                FieldMap fieldsMap;
-                const uint64_t maxToRead{currentIndex + payloadLen};
-                while (currentIndex < maxToRead)
-                {
-                    resolveTopLevelDecodeResult(fieldsMap, decode(objectNode, buffer, currentIndex));
-                }
-                return fieldsMap;
+                return decodeMessage(*message, projection, buffer, currentIndex, currentIndex + payloadLen, resource);
             }
         }
         break;
@@ -1,28 +1,55 @@
 #include <cstring>
-#include <mutex>
+#include <memory>
+#include <memory_resource>
 #include <string>
 
-#include "../deps/HkThreadPool/src/ThreadPool.hpp"
 #include "../deps/HkXML/src/HkXml.hpp"
 #include "CommonTypes.hpp"
+#include "MetaSchema.hpp"
+#include "Projection.hpp"
+#include "WorkStealingPool.hpp"
 
 namespace hk
 {
 class ProtobufDecoder
 {
 public:
-    FieldMap parseProtobufFromBuffer(const XMLDecoder::XmlResult& firstXML,
-        const XMLDecoder::XmlResult& secondXML,
+    /**
+        @brief Decode _buffer_ as an object of class _objectClassName_. Field names of the result point into _schema_,
+        which has to outlive it. Every container of the result gets allocated from _resource_. Only the fields
+        picked by _projection_ get decoded, the rest are skipped over, nullptr decodes them all.
+    */
+    FieldMap parseProtobufFromBuffer(const MetaSchema& schema,
         const std::string& objectClassName,
-        const std::vector<uint8_t>& buffer);
-
-    std::vector<FieldMap> parseProtobuffs(const XMLDecoder::XmlResult& firstXML,
-        const XMLDecoder::XmlResult& secondXML,
+        const ByteSpan buffer,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource(),
+        const Projection::Node* projection = nullptr);
+
+    /**
+        @brief Decode every buffer as an object of the matching class name. Work is split into batches of roughly
+        equal payload bytes, each decoded by one worker, results come back in input order. _projection_ has to be
+        compiled against _schema_, nullptr decodes every field.
+    */
+    std::vector<FieldMap> parseProtobuffs(const MetaSchema& schema,
         const std::vector<std::string>& objectClassName,
-        const std::vector<std::vector<uint8_t>>& buffer);
+        const std::vector<ByteSpan>& buffer,
+        std::pmr::memory_resource* resource = std::pmr::get_default_resource(),
+        const Projection::Compiled* projection = nullptr);
 
     static void printFields(const FieldMap& fm, uint64_t depth = 0);
 
+    /**
+        @brief In zero-copy mode string/bytes fields and enum names are returned as std::string_view pointing into
+        the decoded buffer and the schema instead of being copied. Both have to outlive the decoded FieldMaps.
+    */
+    void setZeroCopy(const bool enabled);
+
+    /**
+        @brief Replace the decoding workers with _threadCount_ new ones, zero meaning one per hardware thread.
+        Not to be called while decoding.
+    */
+    void setThreadCount(const uint32_t threadCount);
+
 private:
     enum class WireType : uint8_t
     {
@@ -49,41 +76,74 @@ private:
 
     struct DecodeResult
     {
-        std::string name;
+        FieldName name;
         bool isRepeated{false};
         std::pair<std::string, FieldValue> field;
     };
 
-    DecodeResult
-    decode(const XMLDecoder::NodeSPtr& objectNode, const std::vector<uint8_t>& buffer, uint64_t& currentIndex);
+    /* Struct payload the caller should decode on its own */
+    struct DeferredStruct
+    {
+        const MetaSchema::MessageSchema* message{nullptr};
+        const Projection::Node* projection{nullptr};
+        uint64_t begin{0};
+        uint64_t end{0};
+    };
+
+    FieldMap decodeMessage(const MetaSchema::MessageSchema& message,
+        const Projection::Node* projection,
+        const ByteSpan buffer,
+        uint64_t& currentIndex,
+        const uint64_t endIndex,
+        std::pmr::memory_resource* resource);
+
+    DecodeResult decode(const MetaSchema::MessageSchema& message,
+        const Projection::Node* projection,
+        const ByteSpan buffer,
+        uint64_t& currentIndex,
+        const uint64_t endIndex,
+        std::pmr::memory_resource* resource,
+        DeferredStruct* deferred = nullptr);
+
+    void skipPayload(const TagDecodeResult& decodedTag,
+        const ByteSpan buffer,
+        uint64_t& currentIndex,
+        const uint64_t endIndex);
 
-    void resolveTopLevelDecodeResult(FieldMap& fieldMap, const DecodeResult& decodeResult);
+    void resolveTopLevelDecodeResult(FieldMap& fieldMap,
+        DecodeResult& decodeResult,
+        std::pmr::memory_resource* resource);
 
-    uint64_t decodeVarInt(const std::vector<uint8_t>& buffer, uint64_t& currentIndex);
+    uint64_t decodeVarInt(const ByteSpan buffer, uint64_t& currentIndex);
 
-    uint64_t decodeNumber64(const std::vector<uint8_t>& buffer, uint64_t& currentIndex);
+    uint64_t decodeNumber64(const ByteSpan buffer, uint64_t& currentIndex);
 
     std::string getTagString(const TagDecodeResult& tag);
 
-    TagDecodeResult decodeTag(const std::vector<uint8_t>& buffer, uint64_t& currentIndex);
+    TagDecodeResult decodeTag(const ByteSpan buffer, uint64_t& currentIndex);
 
-    std::string decodePackedPayload(const uint64_t len, const std::vector<uint8_t>& buffer, uint64_t& currentIndex);
+    std::pmr::string decodePackedPayload(const uint64_t len,
+        const ByteSpan buffer,
+        uint64_t& currentIndex,
+        std::pmr::memory_resource* resource);
 
-    FieldValue decodePayload(const XMLDecoder::NodeSPtr& objectNode,
+    FieldValue decodePayload(const MetaSchema::MessageSchema* message,
+        const Projection::Node* projection,
         const TagDecodeResult& decodedTag,
-        const std::vector<uint8_t>& buffer,
+        const ByteSpan buffer,
         const DecodeHint hint,
-        uint64_t& currentIndex);
+        uint64_t& currentIndex,
+        std::pmr::memory_resource* resource);
 
 private:
-#define META_VERSION_TOP_XML 1
-#define META_VERSION_TOP_NO_XML 0
-    uint8_t metaVersion{META_VERSION_TOP_XML};
-
-    // ThreadPool tp{1};
-    ThreadPool tp{8};
-    std::mutex objectsMapLock;
-    std::vector<std::future<FieldMap>> futures;
-    std::unordered_map<std::string, XMLDecoder::NodeSPtr> objectsMap;
+    /* A batch aims for 1/TASKS_PER_WORKER of a worker's share so uneven payloads still balance out */
+    static constexpr uint64_t TASKS_PER_WORKER{4};
+    static constexpr uint64_t MIN_BATCH_BYTES{32 * 1024};
+    static constexpr uint64_t MAX_BATCH_BYTES{4 * 1024 * 1024};
+    /* Nested structs from this size on get decoded as subtasks */
+    static constexpr uint64_t SUBTASK_MIN_BYTES{16 * 1024};
+
+    std::unique_ptr<WorkStealingPool> pool{std::make_unique<WorkStealingPool>()};
+    bool zeroCopy{false};
 };
 } // namespace hk
@@ -0,0 +1,307 @@
+#include "RecordingIndex.hpp"
+
+#include <algorithm>
+#include <fstream>
+
+#include "CacheFile.hpp"
+#include "Utility.hpp"
+
+namespace hk
+{
+
+std::filesystem::path RecordingIndex::getIndexPath(const std::filesystem::path& recording)
+{
+    std::filesystem::path indexPath{recording};
+    indexPath += ".hkidx";
+    return indexPath;
+}
+
+RecordingIndex::RecordingId RecordingIndex::identify(const std::filesystem::path& recording,
+    std::span<const uint8_t> bytes)
+{
+    std::error_code ec;
+    const auto modifiedTime = std::filesystem::last_write_time(recording, ec);
+    const uint64_t hashedBytes = std::min<uint64_t>(bytes.size(), HEAD_HASH_BYTES);
+    return {.size = bytes.size(),
+        .modifiedTime = ec ? 0 : modifiedTime.time_since_epoch().count(),
+        .headHash = utils::hashBytes(bytes.data(), hashedBytes)};
+}
+
+bool RecordingIndex::identify(const std::filesystem::path& recording, RecordingId& recordingId)
+{
+    std::error_code ec;
+    if (!std::filesystem::is_regular_file(recording, ec))
+    {
+        return false;
+    }
+    const uint64_t size = std::filesystem::file_size(recording, ec);
+    const auto modifiedTime = std::filesystem::last_write_time(recording, ec);
+    std::ifstream in{recording, std::ios::binary};
+    if (ec || in.fail())
+    {
+        return false;
+    }
+
+    std::vector<uint8_t> head(std::min<uint64_t>(size, HEAD_HASH_BYTES));
+    in.read(reinterpret_cast<char*>(head.data()), head.size());
+    if (in.fail())
+    {
+        return false;
+    }
+
+    recordingId = {.size = size,
+        .modifiedTime = modifiedTime.time_since_epoch().count(),
+        .headHash = utils::hashBytes(head.data(), head.size())};
+    return true;
+}
+
+bool RecordingIndex::saveToFile(const std::filesystem::path& path, const RecordingId& recordingId) const
+{
+    utils::CacheWriter payload;
+    payload.put<uint32_t>(frames.size());
+    for (const Frame& frame : frames)
+    {
+        payload.put<uint32_t>(frame.type);
+        payload.put<uint32_t>(frame.compression);
+        payload.put<uint32_t>(frame.frameSize);
+        payload.put<uint64_t>(frame.offset);
+        payload.put<uint32_t>(frame.metaFrame);
+        payload.put<uint8_t>(frame.hasTimeStamps);
+        payload.put<uint64_t>(frame.minTimeStamp);
+        payload.put<uint64_t>(frame.maxTimeStamp);
+    }
+    const uint64_t frameTableSize = payload.bytes.size();
+    const uint64_t frameTableHash = utils::hashBytes(payload.bytes.data(), frameTableSize);
+
+    /* Directory sorted by name, then the names, then the changes of every object one after the other */
+    std::vector<const ObjectMap::value_type*> sorted;
+    sorted.reserve(objects.size());
+    for (const auto& object : objects)
+    {
+        sorted.push_back(&object);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+
+    uint64_t namesSize{0};
+    for (const auto* object : sorted)
+    {
+        namesSize += object->first.size();
+    }
+    const uint64_t namesStart = sorted.size() * DIRECTORY_ENTRY_SIZE;
+    const uint64_t changesStart = namesStart + namesSize;
+
+    utils::CacheWriter directory;
+    utils::CacheWriter names;
+    utils::CacheWriter changeBytes;
+    for (const auto* object : sorted)
+    {
+        const auto& [distName, changes] = *object;
+        const uint64_t firstChange = changeBytes.bytes.size();
+        for (const ObjectChange& change : changes)
+        {
+            changeBytes.put<uint32_t>(change.frame);
+            changeBytes.put<uint32_t>(change.changeSet);
+            changeBytes.put<uint32_t>(change.change);
+        }
+
+        /* Covers the name too, so a lookup landing on a damaged entry can't pass it off as another object's */
+        const uint64_t nameHash =
+            utils::hashBytes(reinterpret_cast<const uint8_t*>(distName.data()), distName.size());
+        directory.put<uint64_t>(namesStart + names.bytes.size());
+        directory.put<uint32_t>(distName.size());
+        directory.put<uint32_t>(changes.size());
+        directory.put<uint64_t>(changesStart + firstChange);
+        directory.put<uint64_t>(utils::hashBytes(changeBytes.bytes.data() + firstChange,
+            changeBytes.bytes.size() - firstChange, nameHash));
+        names.bytes.insert(names.bytes.end(), distName.begin(), distName.end());
+    }
+    for (const utils::CacheWriter* section : {&directory, &names, &changeBytes})
+    {
+        payload.bytes.insert(payload.bytes.end(), section->bytes.begin(), section->bytes.end());
+    }
+
+    utils::CacheWriter header;
+    header.put<uint64_t>(INDEX_MAGIC);
+    header.put<uint32_t>(INDEX_FORMAT_VERSION);
+    header.put<uint64_t>(recordingId.size);
+    header.put<int64_t>(recordingId.modifiedTime);
+    header.put<uint64_t>(recordingId.headHash);
+    header.put<uint64_t>(frameTableSize);
+    header.put<uint64_t>(frameTableHash);
+    header.put<uint32_t>(sorted.size());
+    header.put<uint64_t>(payload.bytes.size() - frameTableSize);
+
+    return utils::writeCacheFile(path, header, payload);
+}
+
+bool RecordingIndex::loadFromFile(const std::filesystem::path& path, const RecordingId& recordingId)
+{
+    std::ifstream in{path, std::ios::binary};
+    std::error_code ec;
+    const uint64_t fileSize = std::filesystem::file_size(path, ec);
+    if (in.fail() || ec)
+    {
+        return false;
+    }
+
+    uint8_t fixedPart[INDEX_HEADER_SIZE];
+    in.read(reinterpret_cast<char*>(fixedPart), sizeof(fixedPart));
+    utils::CacheReader header{.data = fixedPart, .size = sizeof(fixedPart), .ok = !in.fail()};
+    const uint64_t magic = header.get<uint64_t>();
+    const uint32_t formatVersion = header.get<uint32_t>();
+    const RecordingId storedId{.size = header.get<uint64_t>(),
+        .modifiedTime = header.get<int64_t>(),
+        .headHash = header.get<uint64_t>()};
+    const uint64_t frameTableSize = header.get<uint64_t>();
+    const uint64_t frameTableHash = header.get<uint64_t>();
+    const uint32_t storedObjectCount = header.get<uint32_t>();
+    const uint64_t storedObjectSectionSize = header.get<uint64_t>();
+    if (!header.ok || magic != INDEX_MAGIC || formatVersion != INDEX_FORMAT_VERSION || storedId != recordingId)
+    {
+        printlne("Recording index %s is stale, ignoring it", path.c_str());
+        return false;
+    }
+    if (frameTableSize > fileSize - sizeof(fixedPart) ||
+        storedObjectSectionSize != fileSize - sizeof(fixedPart) - frameTableSize ||
+        storedObjectSectionSize / DIRECTORY_ENTRY_SIZE < storedObjectCount)
+    {
+        printlne("Recording index %s is corrupted, ignoring it", path.c_str());
+        return false;
+    }
+
+    /* Only the frame table gets read and checked here, object changes carry their own hashes */
+    std::vector<uint8_t> frameTable(frameTableSize);
+    in.read(reinterpret_cast<char*>(frameTable.data()), frameTable.size());
+    if (in.fail() || utils::hashBytes(frameTable.data(), frameTable.size()) != frameTableHash)
+    {
+        printlne("Recording index %s is corrupted, ignoring it", path.c_str());
+        return false;
+    }
+
+    utils::CacheReader reader{.data = frameTable.data(), .size = frameTable.size()};
+    const uint32_t frameCount = reader.get<uint32_t>();
+    std::vector<Frame> loaded;
+    for (uint32_t i = 0; reader.ok && i < frameCount; i++)
+    {
+        Frame& frame = loaded.emplace_back();
+        frame.type = reader.get<uint32_t>();
+        frame.compression = reader.get<uint32_t>();
+        frame.frameSize = reader.get<uint32_t>();
+        frame.offset = reader.get<uint64_t>();
+        frame.metaFrame = reader.get<uint32_t>();
+        frame.hasTimeStamps = reader.get<uint8_t>();
+        frame.minTimeStamp = reader.get<uint64_t>();
+        frame.maxTimeStamp = reader.get<uint64_t>();
+
+        /* Frames have to lie within the recording, META frames can only govern the frames after them */
+        const bool validMeta = frame.metaFrame == NO_META || frame.metaFrame < i;
+        if (frame.offset > recordingId.size || frame.frameSize > recordingId.size - frame.offset || !validMeta)
+        {
+            reader.ok = false;
+        }
+    }
+    if (!reader.ok || reader.pos != reader.size)
+    {
+        printlne("Recording index %s is corrupted, ignoring it", path.c_str());
+        return false;
+    }
+
+    frames = std::move(loaded);
+    objects.clear();
+    indexPath = path;
+    objectSectionOffset = sizeof(fixedPart) + frameTableSize;
+    objectSectionSize = storedObjectSectionSize;
+    objectCount = storedObjectCount;
+    return true;
+}
+
+bool RecordingIndex::loadObjectChanges(const std::string_view distName, std::vector<ObjectChange>& changes) const
+{
+    changes.clear();
+    std::ifstream in{indexPath, std::ios::binary};
+    if (in.fail())
+    {
+        return false;
+    }
+
+    /* Reads _size_ bytes at _offset_ within the object section, false if that goes past its end */
+    const auto readAt = [this, &in](const uint64_t offset, const uint64_t size, std::vector<uint8_t>& bytes)
+    {
+        if (offset > objectSectionSize || size > objectSectionSize - offset)
+        {
+            return false;
+        }
+        bytes.resize(size);
+        in.seekg(objectSectionOffset + offset);
+        in.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+        return !in.fail();
+    };
+
+    /* Binary search over the directory, every step only reads an entry and its name */
+    std::vector<uint8_t> entry;
+    std::vector<uint8_t> name;
+    uint64_t changesOffset{0};
+    uint32_t changeCount{0};
+    uint64_t storedHash{0};
+    bool found{false};
+    uint64_t low{0};
+    uint64_t high{objectCount};
+    while (low < high && !found)
+    {
+        const uint64_t middle = low + (high - low) / 2;
+        const bool entryRead = readAt(middle * DIRECTORY_ENTRY_SIZE, DIRECTORY_ENTRY_SIZE, entry);
+        utils::CacheReader reader{.data = entry.data(), .size = entry.size(), .ok = entryRead};
+        const uint64_t nameOffset = reader.get<uint64_t>();
+        const uint32_t nameSize = reader.get<uint32_t>();
+        changeCount = reader.get<uint32_t>();
+        changesOffset = reader.get<uint64_t>();
+        storedHash = reader.get<uint64_t>();
+        if (!reader.ok || !readAt(nameOffset, nameSize, name))
+        {
+            printlne("Recording index %s is corrupted, ignoring it", indexPath.c_str());
+            return false;
+        }
+
+        const int order = std::string_view(reinterpret_cast<const char*>(name.data()), name.size()).compare(distName);
+        found = order == 0;
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else if (order > 0)
+        {
+            high = middle;
+        }
+    }
+    if (!found)
+    {
+        return true;
+    }
+
+    std::vector<uint8_t> changeBytes;
+    const uint64_t nameHash = utils::hashBytes(name.data(), name.size());
+    if (!readAt(changesOffset, uint64_t{changeCount} * OBJECT_CHANGE_SIZE, changeBytes) ||
+        utils::hashBytes(changeBytes.data(), changeBytes.size(), nameHash) != storedHash)
+    {
+        printlne("Recording index %s is corrupted, ignoring it", indexPath.c_str());
+        return false;
+    }
+
+    utils::CacheReader reader{.data = changeBytes.data(), .size = changeBytes.size()};
+    changes.reserve(changeCount);
+    for (uint32_t i = 0; i < changeCount; i++)
+    {
+        const ObjectChange& change = changes.emplace_back(ObjectChange{.frame = reader.get<uint32_t>(),
+            .changeSet = reader.get<uint32_t>(),
+            .change = reader.get<uint32_t>()});
+        if (change.frame >= frames.size())
+        {
+            printlne("Recording index %s is corrupted, ignoring it", indexPath.c_str());
+            changes.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace hk
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace hk
+{
+
+/* Where every frame of a recording sits and what it holds, down to which objects every change touches. Kept in a
+   "<recording>.hkidx" file next to the recording, so later runs neither walk the frames from the start nor inflate
+   frames to find out which of them a time range, a frame selection or an object's history needs. The frame table
+   comes first and is all that gets loaded, the changes of every object follow behind a directory sorted by
+   distinguished name so that a single object's can be looked up without reading the others. */
+class RecordingIndex
+{
+public:
+    static constexpr uint32_t NO_META{UINT32_MAX};
+
+    struct Frame
+    {
+        /* Type and compression as found in the frame header */
+        uint32_t type{0};
+        uint32_t compression{0};
+        uint32_t frameSize{0};
+        /* Offset of the frame data, right past the frame header */
+        uint64_t offset{0};
+        /* Position of the META frame governing this one, NO_META if none came before it */
+        uint32_t metaFrame{NO_META};
+        /* Span of the change set timestamps, only known for change set frames that could be read. Frames without
+           any change set span [UINT64_MAX, 0]. */
+        bool hasTimeStamps{false};
+        uint64_t minTimeStamp{UINT64_MAX};
+        uint64_t maxTimeStamp{0};
+    };
+
+    /* Where a change of some object sits: frame position, change set within that frame and change within that
+       change set, all counted from 0 */
+    struct ObjectChange
+    {
+        uint32_t frame{0};
+        uint32_t changeSet{0};
+        uint32_t change{0};
+    };
+
+    /* What the index was built from. Any difference means the recording changed since. */
+    struct RecordingId
+    {
+        uint64_t size{0};
+        int64_t modifiedTime{0};
+        uint64_t headHash{0};
+
+        bool operator==(const RecordingId&) const = default;
+    };
+
+    /* Looks names up by view, so finding an existing object doesn't need a copy of its name */
+    struct NameHash
+    {
+        using is_transparent = void;
+
+        uint64_t operator()(const std::string_view name) const
+        {
+            return std::hash<std::string_view>{}(name);
+        }
+    };
+
+    using ObjectMap = std::unordered_map<std::string, std::vector<ObjectChange>, NameHash, std::equal_to<>>;
+
+    /**
+        @brief Path of the index belonging to the recording at _recording_
+    */
+    static std::filesystem::path getIndexPath(const std::filesystem::path& recording);
+
+    /**
+        @brief Identify the recording at _recording_, _bytes_ being its contents
+    */
+    static RecordingId identify(const std::filesystem::path& recording, std::span<const uint8_t> bytes);
+
+    /**
+        @brief Identify the regular file at _recording_ without reading more of it than gets hashed. False for
+        anything else (pipes, fifos..) or if it can't be read.
+    */
+    static bool identify(const std::filesystem::path& recording, RecordingId& recordingId);
+
+    /**
+        @brief Store the index at _path_ tagged with _recordingId_
+    */
+    bool saveToFile(const std::filesystem::path& path, const RecordingId& recordingId) const;
+
+    /**
+        @brief Load the frame table of an index stored by saveToFile. Files that are truncated, corrupted, written
+        by another format version or built from another recording are rejected. Object changes stay in the file.
+    */
+    bool loadFromFile(const std::filesystem::path& path, const RecordingId& recordingId);
+
+    /**
+        @brief Read every change of the object _distName_ out of the index loaded last, in recording order. Only
+        that object's directory entries and changes get read. Empty if the object never changes, false if its
+        entry is corrupted or the file can't be read anymore.
+    */
+    bool loadObjectChanges(const std::string_view distName, std::vector<ObjectChange>& changes) const;
+
+public:
+    std::vector<Frame> frames;
+    /* Every change of every object in recording order, keyed by distinguished name. Stored by saveToFile, never
+       filled by loadFromFile. */
+    ObjectMap objects;
+
+private:
+    static constexpr uint64_t INDEX_MAGIC{0x5844494345524b48}; // "HKRECIDX"
+    static constexpr uint32_t INDEX_FORMAT_VERSION{3};
+    /* Magic, version, recording id, frame table size and hash, object count and object section size */
+    static constexpr uint64_t INDEX_HEADER_SIZE{8 + 4 + 3 * 8 + 2 * 8 + 4 + 8};
+    /* Name offset and size, change count, changes offset and hash of name and changes */
+    static constexpr uint64_t DIRECTORY_ENTRY_SIZE{8 + 4 + 4 + 8 + 8};
+    static constexpr uint64_t OBJECT_CHANGE_SIZE{3 * 4};
+    /* Only the start of the recording gets hashed, size and modification time catch the rest */
+    static constexpr uint64_t HEAD_HASH_BYTES{64 * 1024};
+
+    /* Where the object section of the index loaded last is, offsets within it are relative to its start */
+    std::filesystem::path indexPath;
+    uint64_t objectSectionOffset{0};
+    uint64_t objectSectionSize{0};
+    uint32_t objectCount{0};
+};
+
+} // namespace hk
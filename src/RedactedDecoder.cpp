@@ -1,252 +1,1114 @@
 #include "RedactedDecoder.hpp"
 
+#include <algorithm>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
+#include <future>
+#include <map>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
 #include <minizip/unzip.h>
+#include <span>
 #include <string>
+#include <sys/mman.h>
+#include <unistd.h>
 #include <zlib.h>
 
+#include "MappedFile.hpp"
 #include "Utility.hpp"
 
 namespace hk
 {
-void ChangeData::loadFromPath(std::ifstream& stream)
+namespace
+{
+/* minizip I/O callbacks reading the zip out of a memory buffer */
+struct MemoryZip
+{
+    const uint8_t* data{nullptr};
+    uint64_t size{0};
+    uint64_t pos{0};
+};
+
+voidpf memoryZipOpen(voidpf opaque, const void*, int)
+{
+    static_cast<MemoryZip*>(opaque)->pos = 0;
+    return opaque;
+}
+
+uLong memoryZipRead(voidpf, voidpf stream, void* buf, uLong size)
+{
+    MemoryZip* zip = static_cast<MemoryZip*>(stream);
+    const uint64_t toRead = std::min<uint64_t>(size, zip->size - zip->pos);
+    std::memcpy(buf, zip->data + zip->pos, toRead);
+    zip->pos += toRead;
+    return toRead;
+}
+
+ZPOS64_T memoryZipTell(voidpf, voidpf stream)
+{
+    return static_cast<MemoryZip*>(stream)->pos;
+}
+
+long memoryZipSeek(voidpf, voidpf stream, ZPOS64_T offset, int origin)
+{
+    MemoryZip* zip = static_cast<MemoryZip*>(stream);
+    uint64_t newPos{0};
+    switch (origin)
+    {
+        case ZLIB_FILEFUNC_SEEK_SET:
+            newPos = offset;
+            break;
+        case ZLIB_FILEFUNC_SEEK_CUR:
+            newPos = zip->pos + offset;
+            break;
+        case ZLIB_FILEFUNC_SEEK_END:
+            newPos = zip->size + offset;
+            break;
+        default:
+            return -1;
+    }
+
+    if (newPos > zip->size)
+    {
+        return -1;
+    }
+    zip->pos = newPos;
+    return 0;
+}
+
+int memoryZipClose(voidpf, voidpf)
+{
+    return 0;
+}
+
+int memoryZipError(voidpf, voidpf)
+{
+    return 0;
+}
+
+XMLDecoder::XmlResult decodeXMLFromMemory(const std::string& xml)
+{
+    /* HkXML only reads from std::ifstream. Give it an anonymous in-memory file so nothing ever touches the disk
+       and concurrent decoder processes can't step on each other. */
+    const int32_t fd = memfd_create("hkMetaXml", MFD_CLOEXEC);
+    if (fd < 0)
+    {
+        return {{}, "Failed to create in-memory file for meta XML"};
+    }
+
+    uint64_t written{0};
+    while (written < xml.size())
+    {
+        const ssize_t ret = write(fd, xml.data() + written, xml.size() - written);
+        if (ret <= 0)
+        {
+            close(fd);
+            return {{}, "Failed to write meta XML to in-memory file"};
+        }
+        written += ret;
+    }
+
+    std::ifstream xmlStream{"/proc/self/fd/" + std::to_string(fd)};
+    close(fd);
+    if (xmlStream.fail())
+    {
+        return {{}, "Failed to open in-memory meta XML"};
+    }
+
+    return XMLDecoder().decodeFromStream(xmlStream);
+}
+
+std::string unzipEntry(unzFile zipFile, const std::string& entryName)
+{
+    if (unzLocateFile(zipFile, entryName.c_str(), 1) != UNZ_OK)
+    {
+        printlne("Failed to find file %s inside the zip", entryName.c_str());
+        return {};
+    }
+
+    unz_file_info64 fileInfo;
+    if (unzGetCurrentFileInfo64(zipFile, &fileInfo, nullptr, 0, nullptr, 0, nullptr, 0) != UNZ_OK)
+    {
+        printlne("Failed to get file info");
+        return {};
+    }
+
+    if (unzOpenCurrentFile(zipFile) != UNZ_OK)
+    {
+        printlne("Failed to open file %s inside the zip", entryName.c_str());
+        return {};
+    }
+
+    /* Size is known up front so the whole entry gets inflated in one go */
+    std::string content(fileInfo.uncompressed_size, '\0');
+    uint64_t totalRead{0};
+    while (totalRead < content.size())
+    {
+        const uint32_t toRead = std::min<uint64_t>(content.size() - totalRead, UINT32_MAX);
+        const int32_t bytesRead = unzReadCurrentFile(zipFile, content.data() + totalRead, toRead);
+        if (bytesRead <= 0)
+        {
+            break;
+        }
+        totalRead += bytesRead;
+    }
+    unzCloseCurrentFile(zipFile);
+
+    if (totalRead != content.size())
+    {
+        printlne("Failed to inflate %s, got %lu out of %lu bytes", entryName.c_str(), totalRead, content.size());
+        return {};
+    }
+    return content;
+}
+
+fs::path getDefaultSchemaCacheDir()
+{
+    /* HK_SCHEMA_CACHE_DIR wins (set it empty to disable caching), then the usual XDG places */
+    if (const char* cacheDir = std::getenv("HK_SCHEMA_CACHE_DIR"))
+    {
+        return cacheDir;
+    }
+    if (const char* xdgCache = std::getenv("XDG_CACHE_HOME"); xdgCache && *xdgCache)
+    {
+        return fs::path{xdgCache} / "redactedDecoder";
+    }
+    if (const char* home = std::getenv("HOME"); home && *home)
+    {
+        return fs::path{home} / ".cache" / "redactedDecoder";
+    }
+    return {};
+}
+} // namespace
+
+ChangeData::ChangeData()
+    : schemaCacheDir{getDefaultSchemaCacheDir()}
+{}
+
+std::string ChangeData::getClassName(const std::string& distName)
+{
+    const auto itStart = distName.find_last_of('/') + 1;
+    const auto itEnd = distName.find_last_of('-');
+    return distName.substr(itStart, itEnd - itStart);
+}
+
+void ChangeData::setSchemaCacheDir(const fs::path& cacheDir)
+{
+    schemaCacheDir = cacheDir;
+}
+
+void ChangeData::setZeroCopy(const bool enabled)
+{
+    protoDecoder.setZeroCopy(enabled);
+    if (decodeCache)
+    {
+        decodeCache->clear();
+    }
+}
+
+void ChangeData::setArenaAllocation(const bool enabled)
+{
+    arenaAllocation = enabled;
+}
+
+void ChangeData::setProjection(const Projection& fieldProjection)
+{
+    projection = fieldProjection;
+    if (decodeCache)
+    {
+        decodeCache->clear();
+    }
+}
+
+void ChangeData::setTimeRange(const uint64_t fromMs, const uint64_t toMs)
+{
+    timeFrom = fromMs;
+    timeTo = toMs;
+}
+
+void ChangeData::setFrameRange(const uint64_t first, const uint64_t last)
+{
+    frameFirst = first;
+    frameLast = last;
+}
+
+void ChangeData::setIndexing(const bool enabled)
+{
+    indexing = enabled;
+}
+
+void ChangeData::setObjectFilter(const std::string& distName)
+{
+    objectFilter = distName;
+}
+
+void ChangeData::setThreadCount(const uint32_t threadCount)
+{
+    protoDecoder.setThreadCount(threadCount);
+}
+
+void ChangeData::setDecodeCache(const uint64_t capacity)
+{
+    decodeCache = capacity ? std::make_unique<DecodeCache>(capacity) : nullptr;
+}
+
+const DecodeCache* ChangeData::getDecodeCache() const
+{
+    return decodeCache.get();
+}
+
+bool ChangeData::loadFromFile(const fs::path& path)
+{
+    FrameCollector collector{frames};
+    return loadFromFile(path, collector);
+}
+
+bool ChangeData::loadFromFile(const fs::path& path, Visitor& visitor)
+{
+    /* Shared with every change set frame, payloads are views into the mapping */
+    std::shared_ptr<utils::MappedFile> mappedFile = std::make_shared<utils::MappedFile>();
+    if (mappedFile->open(path))
+    {
+        const std::span<const uint8_t> fileBytes = mappedFile->bytes();
+        utils::ByteCursor cursor{fileBytes};
+        if (!readHeader(cursor))
+        {
+            return false;
+        }
+        visitor.onHeader(header);
+
+        /* Every frame boundary is known up front, so frames get read without ever waiting on each other. The
+           index spares walking the frames and tells which frames a time range needs without inflating any. */
+        const fs::path indexPath = RecordingIndex::getIndexPath(path);
+        const RecordingIndex::RecordingId recordingId = RecordingIndex::identify(path, fileBytes);
+        std::vector<FrameLocation> locations;
+        const bool indexed = indexing && loadIndex(indexPath, recordingId, locations);
+        bool complete{indexed};
+        if (!indexed)
+        {
+            locations = scanFrames(cursor, complete);
+        }
+
+        /* Only a run reading every frame of an intact recording learns enough to write the index. Truncated
+           recordings are likely still being written and keep getting scanned so their errors stay reported. */
+        const std::vector<bool> skipped = findSkippedFrames(fileBytes, locations);
+        const bool buildIndex = indexing && !indexed && complete &&
+                                std::find(skipped.begin(), skipped.end(), true) == skipped.end();
+        runPipeline([this, &fileBytes, &locations, &skipped, buildIndex, &mappedFile](Pipeline& pipeline)
+            { readFrames(fileBytes, locations, skipped, buildIndex, mappedFile, pipeline); }, visitor);
+
+        if (buildIndex)
+        {
+            saveIndex(indexPath, recordingId, locations);
+        }
+        return true;
+    }
+
+    /* Not something that can be mapped, read it as a plain stream instead */
+    std::ifstream stream{path, std::ios::binary};
+    if (stream.fail())
+    {
+        return false;
+    }
+
+    return loadFromPath(stream, visitor);
+}
+
+bool ChangeData::loadFromPath(std::ifstream& stream)
+{
+    FrameCollector collector{frames};
+    return loadFromPath(stream, collector);
+}
+
+bool ChangeData::loadFromPath(std::ifstream& stream, Visitor& visitor)
 {
     // header section
     header.version = utils::read4(stream);
     utils::read4(stream); /* Unused (header-length) */
     uint32_t additionalInfoSize = utils::read4(stream);
+    if (!stream)
+    {
+        printlne("File too small to even hold a header");
+        return false;
+    }
     header.additionalInfo = utils::readStringBytes(stream, additionalInfoSize);
+    if (!stream)
+    {
+        printlne("Header additional info goes past the end of the file");
+        return false;
+    }
+    visitor.onHeader(header);
 
-    readFrames(stream);
+    runPipeline([this, &stream](Pipeline& pipeline) { readFrames(stream, pipeline); }, visitor);
+    return true;
 }
 
-void ChangeData::readFrames(std::ifstream& stream)
+bool ChangeData::readHeader(utils::ByteCursor& cursor)
 {
-    while (stream.peek() != EOF)
+    if (!cursor.has(12))
+    {
+        printlne("File too small to even hold a header");
+        return false;
+    }
+
+    header.version = cursor.read4();
+    cursor.read4(); /* Unused (header-length) */
+    uint32_t additionalInfoSize = cursor.read4();
+    if (!cursor.has(additionalInfoSize))
+    {
+        printlne("Header additional info goes past the end of the file");
+        return false;
+    }
+    header.additionalInfo = cursor.readString(additionalInfoSize);
+
+    return true;
+}
+
+std::vector<ChangeData::FrameLocation> ChangeData::scanFrames(utils::ByteCursor& cursor, bool& complete)
+{
+    /* Only hop from one frame header to the next, nothing gets inflated or decoded here */
+    std::vector<FrameLocation> locations;
+    uint32_t lastMetaFrame{RecordingIndex::NO_META};
+    while (cursor.remaining() > 0)
+    {
+        // each frame starts with a magic number
+        bool magic = cursor.isMagicNumberNext();
+        if (!magic || !cursor.has(12))
+        {
+            printlne("Something bad happened while reading frames. Not magic number.");
+            break;
+        }
+
+        FrameLocation location;
+        location.type = static_cast<FrameType>(cursor.read4());
+        location.compression = static_cast<CompressionType>(cursor.read4());
+        location.frameSize = cursor.read4();
+        location.offset = cursor.position();
+        location.metaFrame = lastMetaFrame;
+
+        if (!cursor.has(location.frameSize))
+        {
+            printlne("Frame of %u bytes goes past the end of the file", location.frameSize);
+            break;
+        }
+        cursor.skip(location.frameSize);
+
+        if (location.type == FrameType::META)
+        {
+            lastMetaFrame = locations.size();
+        }
+        locations.emplace_back(location);
+    }
+
+    complete = cursor.remaining() == 0;
+    return locations;
+}
+
+void ChangeData::readFrames(std::span<const uint8_t> fileBytes,
+    std::vector<FrameLocation>& locations,
+    const std::vector<bool>& skipped,
+    const bool recordTimeStamps,
+    const std::shared_ptr<const void>& owner,
+    Pipeline& pipeline)
+{
+    /* All META frames are known from the scan, so they get loaded ahead of the frames that need them (a couple at
+       a time to keep memory in check). Identical META frames are only loaded once. */
+    std::vector<uint64_t> metaIndexes;
+    for (uint64_t index = 0; index < locations.size(); index++)
+    {
+        if (locations[index].type == FrameType::META && !skipped[index])
+        {
+            metaIndexes.emplace_back(index);
+        }
+    }
+
+    std::unordered_map<uint64_t, std::shared_future<std::shared_ptr<const MetaSchema>>> metaLoads;
+    std::vector<std::shared_future<std::shared_ptr<const MetaSchema>>> metaSchemas(metaIndexes.size());
+    uint64_t metaStarted{0};
+    uint64_t metaConsumed{0};
+
+    /* Skipped frames never get past the reader, so they're never inflated nor even paged in */
+    for (uint64_t index{0}; auto& location : locations)
+    {
+        const uint64_t position = index++;
+        if (skipped[position])
+        {
+            continue;
+        }
+
+        Frame frame;
+        frame.type = location.type;
+        frame.compression = location.compression;
+        frame.frameSize = location.frameSize;
+        frame.position = position;
+        if (!isFrameSupported(frame))
+        {
+            continue;
+        }
+
+        /* Frame data is parsed straight out of the mapping */
+        const std::span<const uint8_t> frameData = fileBytes.subspan(location.offset, location.frameSize);
+        if (frame.type == FrameType::META)
+        {
+            for (; metaStarted < metaIndexes.size() && metaStarted <= metaConsumed + META_LOOKAHEAD; metaStarted++)
+            {
+                const FrameLocation& metaLocation = locations[metaIndexes[metaStarted]];
+                const std::span<const uint8_t> metaData = fileBytes.subspan(metaLocation.offset,
+                    metaLocation.frameSize);
+                const uint64_t metaHash = utils::hashBytes(metaData.data(), metaData.size());
+
+                auto [it, inserted] = metaLoads.try_emplace(metaHash);
+                if (inserted)
+                {
+                    it->second = std::async(std::launch::async, &ChangeData::loadMeta, this, metaData, metaHash);
+                }
+                metaSchemas[metaStarted] = it->second;
+            }
+
+            /* A new META replaces the previous one even if it fails to load */
+            metaSchema = metaSchemas[metaConsumed++].get();
+            frame.metaSchema = metaSchema;
+        }
+        else if (frame.type == FrameType::CHANGE_SET)
+        {
+            /* Inflating and decoding happen further down the pipeline. Bind the frame to the META read so far, a
+               later META frame must not affect it. */
+            frame.buffer = owner;
+            frame.metaSchema = metaSchema;
+        }
+
+        pipeline.submit({.frame = std::move(frame),
+            .frameData = frameData,
+            .location = recordTimeStamps && location.type == FrameType::CHANGE_SET ? &location : nullptr,
+            .lastChangeSet = location.lastObjectChangeSet.value_or(UINT32_MAX)});
+    }
+}
+
+void ChangeData::readFrames(std::ifstream& stream, Pipeline& pipeline)
+{
+    /* Streams can't be scanned ahead, so the last change set frame is held back until the first timestamp of the
+       next one tells whether it ends before the time range */
+    std::optional<PendingFrame> heldBack;
+    std::optional<uint64_t> heldBackTimeStamp;
+    const auto releaseHeldBack = [this, &pipeline, &heldBack, &heldBackTimeStamp](
+                                     const std::optional<uint64_t> nextFirstTimeStamp)
+    {
+        if (heldBack && isFrameInTimeRange(heldBackTimeStamp, nextFirstTimeStamp))
+        {
+            pipeline.submit(std::move(*heldBack));
+        }
+        heldBack.reset();
+    };
+
+    for (uint64_t position = 0; stream.peek() != EOF; position++)
     {
         // each frame starts with a magic number
         bool magic = utils::isMagicNumberNext(stream);
         if (!magic)
         {
             printlne("Something bad happened while reading frames. Not magic number.");
-            return;
+            break;
         }
 
         Frame frame;
         frame.type = static_cast<FrameType>(utils::read4(stream));
         frame.compression = static_cast<CompressionType>(utils::read4(stream));
         frame.frameSize = utils::read4(stream);
+        frame.position = position;
+
+        /* Which META frames later ones depend on isn't known ahead, so all of them get loaded */
+        if (!isInFrameRange(position) && frame.type != FrameType::META)
+        {
+            stream.ignore(frame.frameSize);
+            continue;
+        }
+
+        /* Input might not be seekable, so skip by reading */
+        if (!isFrameSupported(frame))
+        {
+            stream.ignore(frame.frameSize);
+            continue; // go back at the top
+        }
+
+        /* Pull the whole frame in and parse it from memory, same as the mapped path */
+        std::shared_ptr<const std::vector<uint8_t>> frameData = std::make_shared<const std::vector<uint8_t>>(
+            utils::readBytes(stream, frame.frameSize));
+        if (stream.fail())
+        {
+            printlne("Frame of %u bytes goes past the end of the stream", frame.frameSize);
+            break;
+        }
 
         if (frame.type == FrameType::META)
         {
-            readMetaType(stream, frame.frameSize);
-            loadInMetaAsXML("metaTmp");
+            /* A new META replaces the previous one even if it fails to load */
+            metaSchema = loadMeta(*frameData, utils::hashBytes(frameData->data(), frameData->size()));
+            frame.metaSchema = metaSchema;
         }
         else if (frame.type == FrameType::CHANGE_SET)
         {
-            frame.changeSetData = std::move(readChangeSetType(stream, frame.compression, frame.frameSize));
+            frame.buffer = frameData;
+            frame.metaSchema = metaSchema;
+
+            if (hasTimeRange())
+            {
+                const std::optional<uint64_t> firstTimeStamp = peekFirstTimeStamp(frame.compression, *frameData);
+                releaseHeldBack(firstTimeStamp);
+                heldBack = PendingFrame{.frame = std::move(frame), .frameData = *frameData};
+                heldBackTimeStamp = firstTimeStamp;
+                continue;
+            }
         }
-        else
+
+        /* Frames go out in reading order, the held back one can't wait past this */
+        releaseHeldBack(std::nullopt);
+        pipeline.submit({.frame = std::move(frame), .frameData = *frameData});
+    }
+
+    releaseHeldBack(std::nullopt);
+}
+
+bool ChangeData::isFrameSupported(const Frame& frame)
+{
+    if (frame.type == FrameType::META || frame.type == FrameType::CHANGE_SET || frame.type == FrameType::RESET)
+    {
+        return true;
+    }
+
+    printlne("Reading %d frame type not supported. Skip", (uint8_t)frame.type);
+    return false;
+}
+
+bool ChangeData::loadIndex(const fs::path& indexPath,
+    const RecordingIndex::RecordingId& recordingId,
+    std::vector<FrameLocation>& locations) const
+{
+    RecordingIndex index;
+    if (!index.loadFromFile(indexPath, recordingId))
+    {
+        return false;
+    }
+
+    /* Only the filtered object's changes get read out of the index */
+    std::vector<RecordingIndex::ObjectChange> objectChanges;
+    if (hasObjectFilter() && !index.loadObjectChanges(objectFilter, objectChanges))
+    {
+        return false;
+    }
+
+    /* Frames holding the filtered object are known, so are the ones that don't */
+    const std::optional<uint32_t> lastObjectChangeSet = hasObjectFilter() ? std::optional(NO_OBJECT_CHANGES)
+                                                                          : std::nullopt;
+    locations.reserve(index.frames.size());
+    for (const RecordingIndex::Frame& frame : index.frames)
+    {
+        locations.push_back({.type = static_cast<FrameType>(frame.type),
+            .compression = static_cast<CompressionType>(frame.compression),
+            .frameSize = frame.frameSize,
+            .offset = frame.offset,
+            .metaFrame = frame.metaFrame,
+            .hasTimeStamps = frame.hasTimeStamps,
+            .minTimeStamp = frame.minTimeStamp,
+            .maxTimeStamp = frame.maxTimeStamp,
+            .lastObjectChangeSet = lastObjectChangeSet});
+    }
+
+    for (const RecordingIndex::ObjectChange& change : objectChanges)
+    {
+        std::optional<uint32_t>& lastChangeSet = locations[change.frame].lastObjectChangeSet;
+        if (*lastChangeSet == NO_OBJECT_CHANGES || *lastChangeSet < change.changeSet)
         {
-            printlne("Reading %d frame type not supported. Skip", (uint8_t)frame.type);
-            stream.seekg(frame.frameSize, std::ios::cur);
-            continue; // go back at the top
+            lastChangeSet = change.changeSet;
         }
+    }
+    return true;
+}
 
-        frames.emplace_back(frame);
+void ChangeData::saveIndex(const fs::path& indexPath,
+    const RecordingIndex::RecordingId& recordingId,
+    const std::vector<FrameLocation>& locations)
+{
+    RecordingIndex index;
+    index.frames.reserve(locations.size());
+    for (const FrameLocation& location : locations)
+    {
+        index.frames.push_back({.type = static_cast<uint32_t>(location.type),
+            .compression = static_cast<uint32_t>(location.compression),
+            .frameSize = location.frameSize,
+            .offset = location.offset,
+            .metaFrame = location.metaFrame,
+            .hasTimeStamps = location.hasTimeStamps,
+            .minTimeStamp = location.minTimeStamp,
+            .maxTimeStamp = location.maxTimeStamp});
     }
 
-    /* Remove temporary meta folder */
-    // fs::remove_all("metaTmp/");
+    /* Frames got recorded as workers finished them, put every object's changes back in recording order */
+    index.objects = std::move(indexedObjects);
+    indexedObjects.clear();
+    for (auto& [distName, changes] : index.objects)
+    {
+        std::sort(changes.begin(), changes.end(),
+            [](const RecordingIndex::ObjectChange& a, const RecordingIndex::ObjectChange& b)
+            { return std::tie(a.frame, a.changeSet, a.change) < std::tie(b.frame, b.changeSet, b.change); });
+    }
+    index.saveToFile(indexPath, recordingId);
 }
 
-void ChangeData::readMetaType(std::ifstream& stream, const uint64_t size)
+void ChangeData::recordObjectChanges(const uint64_t position,
+    const std::vector<std::pair<std::string_view, RecordingIndex::ObjectChange>>& objectChanges)
 {
-    println("Unzipping meta..");
+    std::scoped_lock lock{indexedObjectsMutex};
+    for (const auto& [distName, change] : objectChanges)
+    {
+        auto it = indexedObjects.find(distName);
+        if (it == indexedObjects.end())
+        {
+            it = indexedObjects.emplace(std::string(distName), std::vector<RecordingIndex::ObjectChange>{}).first;
+        }
+        it->second.push_back({.frame = static_cast<uint32_t>(position),
+            .changeSet = change.changeSet,
+            .change = change.change});
+    }
+}
 
-    fs::path metaTmpFolderPath = "metaTmp/";
-    fs::path metaZipName = "meta.zip";
-    fs::path metaZipPath = metaTmpFolderPath / metaZipName;
-    fs::create_directories(metaTmpFolderPath.parent_path());
+bool ChangeData::hasTimeRange() const
+{
+    return timeFrom != 0 || timeTo != UINT64_MAX;
+}
 
-    /* Read .zip into a file */
-    std::ofstream outMeta{metaZipPath};
-    char* mBuffer = new char[size];
-    stream.read(mBuffer, size);
-    outMeta.write(mBuffer, size);
-    outMeta.close();
+bool ChangeData::hasObjectFilter() const
+{
+    return !objectFilter.empty();
+}
+
+bool ChangeData::hasFrameRange() const
+{
+    return frameFirst != 0 || frameLast != UINT64_MAX;
+}
 
-    /* cleanup */
-    delete[] mBuffer;
+bool ChangeData::isInFrameRange(const uint64_t position) const
+{
+    return position >= frameFirst && position <= frameLast;
+}
 
-    /* Open file and prepare minizip to unzip it*/
-    unzFile zipFile = unzOpen(metaZipPath.c_str());
-    if (zipFile == nullptr)
+bool ChangeData::isFrameInTimeRange(const std::optional<uint64_t> firstTimeStamp,
+    const std::optional<uint64_t> nextFirstTimeStamp) const
+{
+    /* Change sets are recorded in time order, so a frame ends before the next one starts. Recordings stitched
+       together go back in time though, the next frame doesn't bound this one then. */
+    if (firstTimeStamp && *firstTimeStamp > timeTo)
     {
-        printlne("Failed to open zip file at %s", metaZipPath.c_str());
-        return;
+        return false;
     }
+    if (firstTimeStamp && nextFirstTimeStamp && *nextFirstTimeStamp < timeFrom &&
+        *nextFirstTimeStamp >= *firstTimeStamp)
+    {
+        return false;
+    }
+    return true;
+}
 
-    unz_global_info globalInfo;
-    if (unzGetGlobalInfo(zipFile, &globalInfo) != UNZ_OK)
+std::vector<bool> ChangeData::findSkippedFrames(std::span<const uint8_t> fileBytes,
+    const std::vector<FrameLocation>& locations) const
+{
+    std::vector<bool> skipped(locations.size(), false);
+    if (!hasTimeRange() && !hasFrameRange() && !hasObjectFilter())
     {
-        printlne("Failed to get global info");
-        unzClose(zipFile);
-        return;
+        return skipped;
     }
 
-    /* Read files inside zip */
-    std::string fileName(256, '\0');
-    for (uint64_t i = 0; i < globalInfo.number_entry; i++)
+    /* Walk backwards so the first timestamp of the next change set frame is known. A frame whose timestamp can't
+       be peeked still bounds the frames before it by the one after it. */
+    std::optional<uint64_t> nextFirstTimeStamp;
+    for (uint64_t index = locations.size(); index-- > 0;)
     {
-        if (unzGetCurrentFileInfo64(zipFile, nullptr, fileName.data(), fileName.size(), nullptr, 0, nullptr, 0) !=
-            UNZ_OK)
+        const FrameLocation& location = locations[index];
+        if (location.type == FrameType::META)
+        {
+            continue;
+        }
+        if (!isInFrameRange(index))
+        {
+            skipped[index] = true;
+            continue;
+        }
+        if (location.type == FrameType::CHANGE_SET && location.lastObjectChangeSet == NO_OBJECT_CHANGES)
         {
-            printlne("Failed to get file info");
-            unzClose(zipFile);
-            return;
+            skipped[index] = true;
+            continue;
+        }
+        if (location.type != FrameType::CHANGE_SET || !hasTimeRange())
+        {
+            continue;
         }
 
-        /* Construct path of found file */
-        fs::path filePath = metaTmpFolderPath / fileName;
+        /* Indexed frames know exactly what they hold */
+        if (location.hasTimeStamps)
+        {
+            skipped[index] = location.maxTimeStamp < timeFrom || location.minTimeStamp > timeTo;
+            if (location.minTimeStamp <= location.maxTimeStamp)
+            {
+                nextFirstTimeStamp = location.minTimeStamp;
+            }
+            continue;
+        }
+
+        const std::optional<uint64_t> firstTimeStamp = peekFirstTimeStamp(location.compression,
+            fileBytes.subspan(location.offset, location.frameSize));
+        skipped[index] = !isFrameInTimeRange(firstTimeStamp, nextFirstTimeStamp);
+        if (firstTimeStamp)
+        {
+            nextFirstTimeStamp = firstTimeStamp;
+        }
+    }
 
-        if (unzOpenCurrentFile(zipFile) != UNZ_OK)
+    /* META frames only get loaded for the change set frames left, or when picked themselves */
+    std::vector<bool> metaNeeded(locations.size(), false);
+    for (uint64_t index = 0; index < locations.size(); index++)
+    {
+        const FrameLocation& location = locations[index];
+        if (!skipped[index] && location.type == FrameType::CHANGE_SET && location.metaFrame < locations.size())
+        {
+            metaNeeded[location.metaFrame] = true;
+        }
+    }
+    for (uint64_t index = 0; index < locations.size(); index++)
+    {
+        if (locations[index].type == FrameType::META)
         {
-            printlne("Failed to open file %s inside the zip", fileName.c_str());
-            unzClose(zipFile);
-            return;
+            skipped[index] = !metaNeeded[index] && !(hasFrameRange() && isInFrameRange(index));
         }
+    }
+    return skipped;
+}
 
-        /* Create directories if needed, just in case */
-        fs::create_directories(filePath.parent_path());
+void ChangeData::Pipeline::submit(PendingFrame&& pending)
+{
+    /* Wait for room in the emit stage's reorder buffer */
+    inFlight.acquire();
+    pending.sequence = nextSequence++;
+    toInflate.push(std::move(pending));
+}
 
-        /* Decompress the data and write to file */
-        std::ofstream outDecompressed{filePath, std::ios::binary};
+void ChangeData::runPipeline(const std::function<void(Pipeline&)>& reader, Visitor& visitor)
+{
+    Pipeline pipeline{.visitor = visitor};
+
+    std::vector<std::jthread> inflaters;
+    std::vector<std::jthread> decoders;
+    for (uint32_t i = 0; i < FRAME_WORKERS; i++)
+    {
+        inflaters.emplace_back([this, &pipeline]() { inflateStage(pipeline.toInflate, pipeline.toDecode); });
+        decoders.emplace_back([this, &pipeline]() { decodeStage(pipeline.toDecode, pipeline.toEmit); });
+    }
+    std::jthread emitter{[this, &pipeline]() { emitStage(pipeline); }};
 
-        char buffer[4096];
-        uint32_t bytesRead{0};
-        while ((bytesRead = unzReadCurrentFile(zipFile, buffer, sizeof(buffer))) > 0)
+    /* I/O (and META binding, later frames depend on it) stays on this thread */
+    reader(pipeline);
+
+    /* Shut stages down front to back, each one drains its input before its output gets closed */
+    pipeline.toInflate.close();
+    inflaters.clear();
+    pipeline.toDecode.close();
+    decoders.clear();
+    pipeline.toEmit.close();
+    emitter.join();
+}
+
+void ChangeData::inflateStage(FrameQueue& input, FrameQueue& output)
+{
+    while (std::optional<PendingFrame> pending = input.pop())
+    {
+        if (pending->frame.type == FrameType::CHANGE_SET)
+        {
+            readChangeSetType(*pending);
+        }
+        output.push(std::move(*pending));
+    }
+}
+
+void ChangeData::decodeStage(FrameQueue& input, FrameQueue& output)
+{
+    while (std::optional<PendingFrame> pending = input.pop())
+    {
+        if (pending->frame.type == FrameType::CHANGE_SET)
+        {
+            decodeChangeSets(*pending);
+        }
+        output.push(std::move(*pending));
+    }
+}
+
+void ChangeData::emitStage(Pipeline& pipeline)
+{
+    /* Several frames are worked on at once and can finish in any order. Hold on to the early ones until every
+       frame before them is out, so frames end up in reading order. */
+    std::map<uint64_t, Frame> finishedEarly;
+    uint64_t nextSequence{0};
+    while (std::optional<PendingFrame> pending = pipeline.toEmit.pop())
+    {
+        finishedEarly.emplace(pending->sequence, std::move(pending->frame));
+        while (!finishedEarly.empty() && finishedEarly.begin()->first == nextSequence)
         {
-            outDecompressed.write(buffer, bytesRead);
+            visitFrame(pipeline.visitor, finishedEarly.begin()->second);
+            finishedEarly.erase(finishedEarly.begin());
+            nextSequence++;
+            pipeline.inFlight.release();
         }
+    }
+}
 
-        outDecompressed.close();
-        unzCloseCurrentFile(zipFile);
+void ChangeData::visitFrame(Visitor& visitor, Frame& frame)
+{
+    if (frame.type == FrameType::META)
+    {
+        visitor.onMeta(frame);
+    }
+    else if (frame.type == FrameType::RESET)
+    {
+        visitor.onReset(frame);
+    }
 
-        /* Move to the next file in zip*/
-        if (i + 1 < globalInfo.number_entry)
+    for (const auto& changeSet : frame.changeSetData)
+    {
+        visitor.onChangeSet(frame, changeSet);
+        for (const auto& change : changeSet.changes)
         {
-            if (unzGoToNextFile(zipFile) != UNZ_OK)
-            {
-                printlne("Failed to move to the next file %lu", i + 1);
-                unzClose(zipFile);
-                return;
-            }
+            visitor.onChange(changeSet, change);
+        }
+    }
+
+    /* Whatever the visitor doesn't take over gets released by the caller right after */
+    visitor.onFrame(frame);
+}
+
+ChangeData::FrameCollector::FrameCollector(std::vector<Frame>& output)
+    : frames{output}
+{}
+
+void ChangeData::FrameCollector::onFrame(Frame& frame)
+{
+    frames.emplace_back(std::move(frame));
+}
+
+std::shared_ptr<const MetaSchema> ChangeData::loadMeta(std::span<const uint8_t> metaFrame,
+    const uint64_t metaHash) const
+{
+    /* Same META bytes always compile to the same schema. Try skipping the unzipping and XML parsing entirely. */
+    fs::path cachePath;
+    if (!schemaCacheDir.empty())
+    {
+        char cacheName[32];
+        snprintf(cacheName, sizeof(cacheName), "%016lx.hkschema", metaHash);
+        cachePath = schemaCacheDir / cacheName;
+
+        std::shared_ptr<MetaSchema> cachedSchema = std::make_shared<MetaSchema>();
+        if (cachedSchema->loadFromFile(cachePath, metaHash))
+        {
+            println("Loaded compiled meta from %s", cachePath.c_str());
+            return cachedSchema;
         }
     }
 
-    /* Close zip descriptor and remove the meta.zip placeholder */
+    std::shared_ptr<const MetaSchema> schema = loadInMetaAsXML(readMetaType(metaFrame));
+
+    if (schema && !cachePath.empty())
+    {
+        schema->saveToFile(cachePath, metaHash);
+    }
+    return schema;
+}
+
+ChangeData::MetaFiles ChangeData::readMetaType(std::span<const uint8_t> metaFrame) const
+{
+    println("Unzipping meta..");
+
+    /* Let minizip read the .zip straight out of the frame buffer */
+    MemoryZip memoryZip{.data = metaFrame.data(), .size = metaFrame.size()};
+    zlib_filefunc64_def memoryFileFuncs{
+        .zopen64_file = &memoryZipOpen,
+        .zread_file = &memoryZipRead,
+        .zwrite_file = nullptr,
+        .ztell64_file = &memoryZipTell,
+        .zseek64_file = &memoryZipSeek,
+        .zclose_file = &memoryZipClose,
+        .zerror_file = &memoryZipError,
+        .opaque = &memoryZip,
+    };
+
+    unzFile zipFile = unzOpen2_64("meta.zip", &memoryFileFuncs);
+    if (zipFile == nullptr)
+    {
+        printlne("Failed to open zip file from META frame");
+        return {};
+    }
+
+    /* Only the two meta.xml files are of interest, inflate them directly in memory */
+    MetaFiles metaFiles;
+    metaFiles.beMeta = unzipEntry(zipFile, "bm/meta.xml");
+    metaFiles.elMeta = unzipEntry(zipFile, "lte/meta.xml");
     unzClose(zipFile);
-    fs::remove_all(metaZipPath);
 
     println("Done unzipping meta");
+    return metaFiles;
 }
 
-void ChangeData::loadInMetaAsXML(const fs::path metaPath)
+std::shared_ptr<const MetaSchema> ChangeData::loadInMetaAsXML(const MetaFiles& metaFiles) const
 {
     println("Loading meta XML in..");
-    std::ifstream beMeta{metaPath / "bm/meta.xml"};
-    std::ifstream elMeta{metaPath / "lte/meta.xml"};
 
-    if (beMeta.fail() || elMeta.fail())
+    if (metaFiles.beMeta.empty() || metaFiles.elMeta.empty())
     {
         printlne("One of the meta files failed to load for xml parsing");
-        return;
+        return nullptr;
     }
 
-    beXmlResult = XMLDecoder().decodeFromStream(beMeta);
+    /* The two documents are independent, parse them at the same time */
+    std::future<XMLDecoder::XmlResult> beFuture = std::async(std::launch::async, &decodeXMLFromMemory,
+        std::cref(metaFiles.beMeta));
+    const XMLDecoder::XmlResult elXmlResult = decodeXMLFromMemory(metaFiles.elMeta);
+    const XMLDecoder::XmlResult beXmlResult = beFuture.get();
+
     if (!beXmlResult.second.empty())
     {
         printlne("Error while parsing XML: %s", beXmlResult.second.c_str());
-        beXmlResult = XMLDecoder::XmlResult{}; // reset it to nothing
-        return;
+        return nullptr;
     }
 
-    elXmlResult = XMLDecoder().decodeFromStream(elMeta);
     if (!elXmlResult.second.empty())
     {
         printlne("Error while parsing XML: %s", elXmlResult.second.c_str());
-        elXmlResult = XMLDecoder::XmlResult{}; // reset it to nothing
-        return;
+        return nullptr;
+    }
+
+    /* Compile every object once. The result is never modified again so decoding threads share it freely. */
+    std::shared_ptr<MetaSchema> schema = std::make_shared<MetaSchema>();
+    if (!schema->compileFromXML(beXmlResult, elXmlResult))
+    {
+        printlne("Failed to compile meta schema");
+        return nullptr;
     }
 
     println("Loading meta XML done");
+    return schema;
 }
 
-ChangeData::ChangeSetDataVec
-ChangeData::readChangeSetType(std::ifstream& stream, const CompressionType cType, const uint64_t size)
+void ChangeData::readChangeSetType(PendingFrame& pending)
 {
-    if (cType == CompressionType::GZIP)
+    Frame& frame = pending.frame;
+    if (frame.compression == CompressionType::GZIP)
     {
-        fs::path tempPath = "tmp/decomp_tmp.bin";
-        if (decompressGZipChangeSetFrame(stream, size, tempPath))
+        /* Whole frame gets inflated in memory and parsed from there, nothing goes to disk. The inflated data
+           becomes the frame's buffer as the payloads point into it. */
+        std::shared_ptr<std::vector<uint8_t>> decompressedData = std::make_shared<std::vector<uint8_t>>();
+        if (decompressGZipChangeSetFrame(pending.frameData, *decompressedData))
         {
-            std::ifstream decompressedData{tempPath};
-
-            /* Get file size so we know how much to decode*/
-            decompressedData.seekg(0, std::ios::end);
-            uint64_t fileSize = decompressedData.tellg();
-            decompressedData.seekg(std::ios::beg);
-
-            return internalReadChangeSetType(decompressedData, fileSize, tempPath);
+            frame.buffer = decompressedData;
+            frame.changeSetData = internalReadChangeSetType(utils::ByteCursor{*decompressedData}, pending);
         }
         else
         {
             printlne("Failed to decompress frame. Skipping over it.");
-            stream.seekg(size, std::ios::cur);
-            return ChangeSetDataVec{};
+            frame.buffer.reset();
         }
     }
-    if (cType == CompressionType::NO_COMPRESSION)
+    else if (frame.compression == CompressionType::NO_COMPRESSION)
     {
-        return internalReadChangeSetType(stream, size, "");
+        frame.changeSetData = internalReadChangeSetType(utils::ByteCursor{pending.frameData}, pending);
     }
     else
     {
-        printlne("Compression type %d not supported. Skipping over it.", (uint8_t)cType);
-        stream.seekg(size, std::ios::cur);
-        return ChangeSetDataVec{};
+        printlne("Compression type %d not supported. Skipping over it.", (uint8_t)frame.compression);
+        frame.buffer.reset();
     }
 
-    return ChangeSetDataVec{};
+    /* Raw frame bytes aren't needed past this point, the buffer may even be gone already */
+    pending.frameData = {};
 }
 
-ChangeData::ChangeSetDataVec
-ChangeData::internalReadChangeSetType(std::ifstream& stream, const uint64_t size, const fs::path& tempPath)
+ChangeData::ChangeSetDataVec ChangeData::internalReadChangeSetType(utils::ByteCursor cursor, PendingFrame& pending)
 {
     ChangeSetDataVec changeSetVec;
-    uint64_t currentCursorPos = stream.tellg();
-    const uint64_t maxToRead{currentCursorPos + size};
+    std::vector<ByteSpan>& protobufData = pending.payloads;
+    std::vector<std::string>& protobufCns = pending.classNames;
+    uint64_t minTimeStamp{UINT64_MAX};
+    uint64_t maxTimeStamp{0};
+    /* Names point into the frame, they only get copied for objects the index hasn't seen yet */
+    std::vector<std::pair<std::string_view, RecordingIndex::ObjectChange>> objectChanges;
 
-    std::vector<std::vector<uint8_t>> protobufData;
-    std::vector<std::string> protobufCns;
-
-    /* Exhaust the stream into a vector of changeSet */
-    while (currentCursorPos < maxToRead)
+    /* Exhaust the frame into a vector of changeSet. Bounds are checked once per group of fields. Payloads of all
+       change sets are collected first and decoded together so the decoder gets enough work to batch across all
+       of its workers, most change sets only hold a couple of changes. */
+    bool truncated{false};
+    for (uint32_t changeSetOrdinal = 0; cursor.remaining() > 0 && changeSetOrdinal <= pending.lastChangeSet;
+         changeSetOrdinal++)
     {
         ChangeSetData changeSet;
+        const uint64_t firstPayload = protobufData.size();
+        const uint64_t firstObjectChange = objectChanges.size();
 
-        changeSet.timeStamp = utils::read8(stream);
-        changeSet.numberOfChanges = utils::read4(stream);
+        if (!cursor.has(12))
+        {
+            truncated = true;
+            break;
+        }
+        changeSet.timeStamp = cursor.read8();
+        changeSet.numberOfChanges = cursor.read4();
+        const bool inTimeRange = changeSet.timeStamp >= timeFrom && changeSet.timeStamp <= timeTo;
 
         for (uint32_t i = 0; i < changeSet.numberOfChanges; i++)
         {
             SingleChange change;
-            uint32_t nameSize = utils::read2(stream);
-            change.name = utils::readStringBytes(stream, nameSize);
-            change.type = static_cast<ChangeType>(utils::read1(stream));
+            if (!cursor.has(2))
+            {
+                truncated = true;
+                break;
+            }
+            uint32_t nameSize = cursor.read2();
+            if (!cursor.has(nameSize + 1))
+            {
+                truncated = true;
+                break;
+            }
+            const std::span<const uint8_t> nameBytes = cursor.readSpan(nameSize);
+            change.name.assign(nameBytes.begin(), nameBytes.end());
+            change.type = static_cast<ChangeType>(cursor.read1());
+            std::string name = getClassName(change.name);
+
+            if (pending.location)
+            {
+                objectChanges.push_back({std::string_view(reinterpret_cast<const char*>(nameBytes.data()),
+                                             nameBytes.size()),
+                    {.frame = 0, .changeSet = changeSetOrdinal, .change = i}});
+            }
+
+            /* Changes out of the time range, of other objects or of classes left out of the projection only get
+               stepped over */
+            if (!inTimeRange || (hasObjectFilter() && change.name != objectFilter) ||
+                (!projection.empty() && !projection.wantsClass(name)))
+            {
+                if (change.type == ChangeType::CREATE_UPDATE)
+                {
+                    if (!cursor.has(4))
+                    {
+                        truncated = true;
+                        break;
+                    }
+                    const uint32_t protoBufSize = cursor.read4();
+                    if (!cursor.has(protoBufSize))
+                    {
+                        truncated = true;
+                        break;
+                    }
+                    cursor.skip(protoBufSize);
+                }
+                continue;
+            }
 
             if (change.type == ChangeType::DELETED)
             {
@@ -254,63 +1116,267 @@ ChangeData::internalReadChangeSetType(std::ifstream& stream, const uint64_t size
             }
             else if (change.type == ChangeType::CREATE_UPDATE)
             {
-                change.protoBufSize = utils::read4(stream);
-                protobufData.emplace_back(utils::readBytes(stream, change.protoBufSize));
-
-                const auto itStart = change.name.find_last_of('/') + 1;
-                const auto itEnd = change.name.find_last_of('-');
-                std::string name = change.name.substr(itStart, itEnd - itStart);
-                protobufCns.emplace_back(name);
+                if (!cursor.has(4))
+                {
+                    truncated = true;
+                    break;
+                }
+                change.protoBufSize = cursor.read4();
+                if (!cursor.has(change.protoBufSize))
+                {
+                    truncated = true;
+                    break;
+                }
+                change.payload = cursor.readSpan(change.protoBufSize);
+                protobufData.emplace_back(change.payload);
+                protobufCns.emplace_back(std::move(name));
             }
             else
             {
                 printlne("Change type not suppored: %d", static_cast<uint8_t>(change.type));
             }
 
-            changeSet.changes.emplace_back(change);
+            changeSet.changes.emplace_back(std::move(change));
+        }
+
+        if (truncated)
+        {
+            /* Incomplete change set gets dropped, so do its payloads and the objects it touched */
+            protobufData.resize(firstPayload);
+            protobufCns.resize(firstPayload);
+            objectChanges.resize(firstObjectChange);
+            break;
         }
 
-        std::vector<FieldMap> decodedData = protoDecoder.parseProtobuffs(beXmlResult, elXmlResult, protobufCns,
-            protobufData);
+        /* Filtered out change sets still count towards the frame's span */
+        minTimeStamp = std::min(minTimeStamp, changeSet.timeStamp);
+        maxTimeStamp = std::max(maxTimeStamp, changeSet.timeStamp);
 
-        uint64_t i{0};
+        /* When following a single object, change sets not touching it are left out as if their frame was skipped */
+        if (inTimeRange && (!hasObjectFilter() || !changeSet.changes.empty()))
+        {
+            changeSetVec.emplace_back(std::move(changeSet));
+        }
+    }
+
+    if (truncated)
+    {
+        printlne("Change set data ends in the middle of a change set. Dropping the incomplete one.");
+    }
+
+    if (pending.location)
+    {
+        pending.location->hasTimeStamps = true;
+        pending.location->minTimeStamp = minTimeStamp;
+        pending.location->maxTimeStamp = maxTimeStamp;
+        recordObjectChanges(pending.frame.position, objectChanges);
+    }
+
+    return changeSetVec;
+}
+
+void ChangeData::decodeChangeSets(PendingFrame& pending)
+{
+    const std::shared_ptr<const MetaSchema>& schema = pending.frame.metaSchema;
+    if (!schema && !pending.payloads.empty())
+    {
+        printlne("No META loaded before this change set, changes will have no fields");
+    }
+
+    std::shared_ptr<const Projection::Compiled> compiledProjection;
+    if (schema && !projection.empty())
+    {
+        compiledProjection = getCompiledProjection(schema);
+    }
+
+    if (decodeCache && schema)
+    {
+        decodeCachedChangeSets(pending, compiledProjection.get());
+        return;
+    }
+
+    std::pmr::memory_resource* resource = std::pmr::get_default_resource();
+    if (arenaAllocation && schema && !pending.payloads.empty())
+    {
+        pending.frame.arena = std::make_shared<DecodeArena>();
+        resource = pending.frame.arena.get();
+    }
+
+    std::vector<FieldMap> decodedData = schema
+                                            ? protoDecoder.parseProtobuffs(*schema, pending.classNames,
+                                                  pending.payloads, resource, compiledProjection.get())
+                                            : std::vector<FieldMap>(pending.payloads.size());
+
+    /* Scatter results back, they come in the same order the payloads were collected in */
+    uint64_t i{0};
+    for (auto& changeSet : pending.frame.changeSetData)
+    {
         for (auto& change : changeSet.changes)
         {
-            if (change.type == ChangeType::DELETED)
+            if (change.type != ChangeType::CREATE_UPDATE)
             {
                 continue;
             }
 
-            change.fields = decodedData[i];
+            change.fields = std::move(decodedData[i]);
             i++;
         }
+    }
+}
 
-        changeSetVec.emplace_back(changeSet);
-        protobufCns.clear();
-        protobufData.clear();
+void ChangeData::decodeCachedChangeSets(PendingFrame& pending, const Projection::Compiled* compiledProjection)
+{
+    const std::shared_ptr<const MetaSchema>& schema = pending.frame.metaSchema;
+    const std::vector<ByteSpan>& payloads = pending.payloads;
+    const std::vector<std::string>& classNames = pending.classNames;
+    std::vector<uint64_t> keys(payloads.size());
+    std::vector<std::shared_ptr<const FieldMap>> decoded(payloads.size());
+    /* Which payload's tree each one gets, repeats of a payload missing from the cache take its first occurrence's */
+    std::vector<uint64_t> source(payloads.size());
 
-        /* Get updated cursor pos so we know if we should stop or not */
-        currentCursorPos = stream.tellg();
+    /* Payloads missing from the cache, each distinct one decoded once even if the frame repeats it */
+    std::unordered_map<uint64_t, uint64_t> firstMissing;
+    std::vector<uint64_t> missing;
+    std::vector<std::string> missingClassNames;
+    std::vector<ByteSpan> missingPayloads;
+    for (uint64_t i = 0; i < payloads.size(); i++)
+    {
+        keys[i] = DecodeCache::makeKey(schema.get(), classNames[i], payloads[i]);
+        decoded[i] = decodeCache->find(keys[i], schema.get(), classNames[i], payloads[i]);
+        source[i] = i;
+        if (decoded[i])
+        {
+            continue;
+        }
+
+        const auto [it, first] = firstMissing.try_emplace(keys[i], i);
+        if (!first && classNames[it->second] == classNames[i] &&
+            std::ranges::equal(payloads[it->second], payloads[i]))
+        {
+            source[i] = it->second;
+            continue;
+        }
+        missing.push_back(i);
+        missingClassNames.push_back(classNames[i]);
+        missingPayloads.push_back(payloads[i]);
     }
 
-    /* Perform cleanup due to frame being unzipped */
-    if (!tempPath.empty())
+    /* Cached trees outlive the frame, they can't live in its arena nor point into its buffer. Misses get decoded
+       out of the copies the cache keeps, so zero-copy strings point into those. */
+    if (!missing.empty())
     {
-        fs::remove_all(tempPath.parent_path());
+        std::vector<std::vector<uint8_t>> missingCopies;
+        missingCopies.reserve(missing.size());
+        for (ByteSpan& payload : missingPayloads)
+        {
+            const std::vector<uint8_t>& copy = missingCopies.emplace_back(payload.begin(), payload.end());
+            payload = copy;
+        }
+
+        std::vector<FieldMap> decodedData = protoDecoder.parseProtobuffs(*schema, missingClassNames,
+            missingPayloads, std::pmr::get_default_resource(), compiledProjection);
+        for (uint64_t i = 0; i < missing.size(); i++)
+        {
+            const uint64_t index = missing[i];
+            decoded[index] = decodeCache->insert(keys[index], schema, classNames[index], std::move(missingCopies[i]),
+                std::move(decodedData[i]));
+        }
     }
-    return changeSetVec;
+
+    uint64_t i{0};
+    for (auto& changeSet : pending.frame.changeSetData)
+    {
+        for (auto& change : changeSet.changes)
+        {
+            if (change.type != ChangeType::CREATE_UPDATE)
+            {
+                continue;
+            }
+
+            change.sharedFields = decoded[source[i]];
+            i++;
+        }
+    }
+}
+
+std::shared_ptr<const Projection::Compiled> ChangeData::getCompiledProjection(
+    const std::shared_ptr<const MetaSchema>& schema)
+{
+    std::scoped_lock lock{projectionMutex};
+    std::erase_if(compiledProjections, [](const auto& entry) { return entry.first.expired(); });
+    for (const auto& [compiledSchema, compiled] : compiledProjections)
+    {
+        if (compiledSchema.lock() == schema)
+        {
+            return compiled;
+        }
+    }
+
+    /* Recordings rarely carry more than a couple of META frames, compiling under the lock is fine */
+    std::shared_ptr<const Projection::Compiled> compiled = projection.compile(*schema);
+    compiledProjections.emplace_back(schema, compiled);
+    return compiled;
+}
+
+std::optional<uint64_t> ChangeData::peekFirstTimeStamp(const CompressionType compression,
+    std::span<const uint8_t> frameData) const
+{
+    if (compression == CompressionType::NO_COMPRESSION)
+    {
+        if (frameData.size() < sizeof(uint64_t))
+        {
+            return std::nullopt;
+        }
+        return utils::ByteCursor{frameData}.read8();
+    }
+    if (compression != CompressionType::GZIP)
+    {
+        return std::nullopt;
+    }
+
+    /* Inflate stops as soon as the output is full, only the first deflate block gets looked at */
+    uint8_t firstBytes[sizeof(uint64_t)];
+    z_stream zstream;
+    zstream.zalloc = Z_NULL;
+    zstream.zfree = Z_NULL;
+    zstream.opaque = Z_NULL;
+    zstream.avail_in = frameData.size();
+    zstream.next_in = const_cast<Bytef*>(frameData.data());
+    if (inflateInit2(&zstream, 16 + MAX_WBITS) != Z_OK)
+    {
+        return std::nullopt;
+    }
+
+    zstream.avail_out = sizeof(firstBytes);
+    zstream.next_out = firstBytes;
+    int32_t retStatus{Z_OK};
+    while (zstream.avail_out > 0 && retStatus == Z_OK)
+    {
+        retStatus = inflate(&zstream, Z_NO_FLUSH);
+    }
+    inflateEnd(&zstream);
+
+    if (zstream.avail_out > 0)
+    {
+        return std::nullopt;
+    }
+    return utils::ByteCursor{std::span<const uint8_t>(firstBytes)}.read8();
 }
 
-bool ChangeData::decompressGZipChangeSetFrame(std::ifstream& stream, uint64_t size, fs::path outputPath)
+bool ChangeData::decompressGZipChangeSetFrame(std::span<const uint8_t> compressed, std::vector<uint8_t>& output)
 {
-    /* Create parent tmp directory since opening a path will not create the directories */
-    fs::create_directories(outputPath.parent_path());
+    const uint64_t size = compressed.size();
 
-    /* Current strategy: read all data inside a buffer, then pass this buffer to zlib for decompression, then
-     * write the result to an output file. Callee will open this file and read changes as if nothing happened.
-     */
-    char* buff = new char[size];
-    stream.read(buff, size);
+    /* GZIP trailer ends with the little endian uncompressed size (mod 2^32). Use it to size the output so the data
+       usually gets inflated in a single call. Don't trust it blindly though, deflate can't expand more than ~1032x. */
+    uint64_t expectedSize{0};
+    if (size >= 4)
+    {
+        expectedSize = compressed[size - 4] | compressed[size - 3] << 8 | compressed[size - 2] << 16 |
+                       (uint64_t)compressed[size - 1] << 24;
+    }
+    expectedSize = std::clamp<uint64_t>(expectedSize, 4096, std::max<uint64_t>(size * 1032, 4096));
+    output.resize(expectedSize);
 
     /* Setup zlib */
     z_stream zstream;
@@ -318,40 +1384,42 @@ bool ChangeData::decompressGZipChangeSetFrame(std::ifstream& stream, uint64_t si
     zstream.zfree = Z_NULL;
     zstream.opaque = Z_NULL;
     zstream.avail_in = size;
-    zstream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(buff));
+    zstream.next_in = const_cast<Bytef*>(compressed.data());
 
     if (inflateInit2(&zstream, 16 + MAX_WBITS) != Z_OK)
     {
-        delete[] buff;
         printlne("Failed to initialize zlib");
         return false;
     }
 
-    std::ofstream outFile{outputPath};
-
-    char outBuffer[4096];
-    int32_t retStatus;
-
-    do
+    uint64_t produced{0};
+    int32_t retStatus{Z_OK};
+    while (retStatus != Z_STREAM_END)
     {
-        zstream.avail_out = sizeof(outBuffer);
-        zstream.next_out = reinterpret_cast<Bytef*>(outBuffer);
+        /* Grow geometrically if the size hint was wrong */
+        if (produced == output.size())
+        {
+            output.resize(output.size() * 2);
+        }
+
+        const uint32_t outAvailable = std::min<uint64_t>(output.size() - produced, UINT32_MAX);
+        zstream.avail_out = outAvailable;
+        zstream.next_out = output.data() + produced;
 
         retStatus = inflate(&zstream, Z_NO_FLUSH);
-        if (retStatus == Z_STREAM_ERROR)
+        produced += outAvailable - zstream.avail_out;
+
+        /* There's always output space here, so Z_BUF_ERROR means the input ended before the stream did */
+        if (retStatus != Z_OK && retStatus != Z_STREAM_END)
         {
             inflateEnd(&zstream);
-            delete[] buff;
-            printlne("Failed to inflate some part of the data");
+            printlne("Failed to inflate some part of the data (%d)", retStatus);
             return false;
         }
-
-        outFile.write(outBuffer, sizeof(outBuffer) - zstream.avail_out);
-    } while (retStatus != Z_STREAM_END);
+    }
 
     inflateEnd(&zstream);
-    delete[] buff;
-    outFile.close();
+    output.resize(produced);
 
     return true;
 }
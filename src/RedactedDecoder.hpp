@@ -2,10 +2,23 @@
 
 #include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <semaphore>
+#include <span>
 
 #include "../deps/HkXML/src/HkXml.hpp"
+#include "BoundedQueue.hpp"
+#include "ByteCursor.hpp"
 #include "CommonTypes.hpp"
+#include "DecodeArena.hpp"
+#include "DecodeCache.hpp"
+#include "MetaSchema.hpp"
+#include "Projection.hpp"
 #include "ProtoDecoder.hpp"
+#include "RecordingIndex.hpp"
 
 namespace hk
 {
@@ -27,12 +40,27 @@ public:
         std::string name{};
         ChangeType type{ChangeType::UNKNOWN};
         uint32_t protoBufSize{0};
+        /* Raw protobuf bytes, a view into the owning frame's buffer */
+        std::span<const uint8_t> payload{};
         FieldMap fields{};
+        /* Set instead of fields when decoding through the decode cache: the tree decoded out of the first payload
+           with these bytes, shared with every other one and never modified. Zero-copy strings in there point into
+           the cache's copy of the payload, views copied out of it stay valid only while the tree is held. */
+        std::shared_ptr<const FieldMap> sharedFields{};
+
+        /**
+            @brief Decoded fields, wherever they ended up
+        */
+        const FieldMap& getFields() const
+        {
+            return sharedFields ? *sharedFields : fields;
+        }
     };
 
     struct ChangeSetData
     {
         uint64_t timeStamp{0};
+        /* As recorded, changes only holds the projected ones when decoding with a projection */
         uint32_t numberOfChanges{0};
         std::vector<SingleChange> changes;
     };
@@ -60,6 +88,14 @@ public:
         FrameType type{FrameType::UNKNOWN};
         CompressionType compression{CompressionType::UNKNOWN};
         uint32_t frameSize{0};
+        /* Position in the recording, counting every frame from 0 */
+        uint64_t position{0};
+        /* Payloads and zero-copy strings point into these (mapped file or inflated frame, schema for field and enum
+           names), decoded fields live in the arena when decoding with one. Declared before the change sets so they
+           get released after them. */
+        std::shared_ptr<const void> buffer;
+        std::shared_ptr<const MetaSchema> metaSchema;
+        std::shared_ptr<DecodeArena> arena;
         ChangeSetDataVec changeSetData;
     };
 
@@ -69,22 +105,322 @@ public:
         std::string additionalInfo{};
     };
 
-    void loadFromPath(std::ifstream& stream);
+    /* Gets the recording handed over piece by piece as soon as it's decoded. Calls come from a single thread,
+       in recording order: onHeader first, then for every frame onMeta (META frames), onReset (RESET frames) or
+       onChangeSet followed by onChange for each of its changes, and onFrame once the frame has been fully visited.
+       A frame and all its changes are released right after its onFrame call unless the visitor moves them out. */
+    class Visitor
+    {
+    public:
+        virtual ~Visitor() = default;
+
+        virtual void onHeader(const Header&) {}
+        virtual void onMeta(const Frame&) {}
+        /* The recorded state starts over, whatever the changes so far built up no longer holds */
+        virtual void onReset(const Frame&) {}
+        virtual void onChangeSet(const Frame&, const ChangeSetData&) {}
+        virtual void onChange(const ChangeSetData&, const SingleChange&) {}
+        virtual void onFrame(Frame&) {}
+    };
+
+    ChangeData();
+
+    /**
+        @brief Get the class of the managed object named _distName_: "PLMN-PLMN/MRBTS-1/AAA-2" is of class "AAA"
+    */
+    static std::string getClassName(const std::string& distName);
+
+    /**
+        @brief Load header and frames of the recording at _path_ into _header_ and _frames_. Regular files get
+        memory mapped and parsed in place, anything else (pipes, fifos..) falls back to being read as a stream.
+    */
+    bool loadFromFile(const fs::path& path);
+
+    /**
+        @brief Same as loadFromFile but hands everything to _visitor_ instead of keeping it in _frames_, so memory
+        use stays bounded by the number of frames in flight instead of growing with the file size.
+    */
+    bool loadFromFile(const fs::path& path, Visitor& visitor);
+
+    /**
+        @brief Same as loadFromFile for an already opened _stream_. False if the header can't be read.
+    */
+    bool loadFromPath(std::ifstream& stream);
+    bool loadFromPath(std::ifstream& stream, Visitor& visitor);
+
+    /**
+        @brief Set where compiled meta schemas get cached between runs. Empty path disables the cache.
+    */
+    void setSchemaCacheDir(const fs::path& cacheDir);
+
+    /**
+        @brief Decode string/bytes fields and enum names as std::string_view instead of copies. Views stay valid for
+        as long as the frame holding the change is alive.
+    */
+    void setZeroCopy(const bool enabled);
+
+    /**
+        @brief Allocate everything decoded out of a frame from an arena owned by that frame (Frame::arena) instead of
+        one allocation per container. It all gets released at once along with the frame.
+    */
+    void setArenaAllocation(const bool enabled);
+
+    /**
+        @brief Only keep changes of the classes in _fieldProjection_ and only decode their listed fields. Changes of
+        other classes are dropped without their payload being looked at. An empty projection keeps everything.
+    */
+    void setProjection(const Projection& fieldProjection);
+
+    /**
+        @brief Only keep change sets stamped within [_fromMs_, _toMs_] (epoch milliseconds). Frames entirely out of
+        the range are dropped before being inflated, change sets out of it are never decoded.
+    */
+    void setTimeRange(const uint64_t fromMs, const uint64_t toMs);
+
+    /**
+        @brief Only keep the frames at positions _first_ to _last_ of the recording, counting every frame from 0.
+        META frames the kept ones depend on still get loaded.
+    */
+    void setFrameRange(const uint64_t first, const uint64_t last);
+
+    /**
+        @brief Only keep the changes of the object named _distName_ (its full distinguished name) and the change sets
+        holding them, only decoding its payloads. With the recording index only the frames holding the object get
+        read. Empty keeps every object.
+    */
+    void setObjectFilter(const std::string& distName);
+
+    /**
+        @brief Keep an index of the frames next to each mapped recording ("<recording>.hkidx"). It gets written by
+        the first run reading every frame and reused as long as the recording doesn't change. On by default.
+    */
+    void setIndexing(const bool enabled);
+
+    /**
+        @brief Number of threads decoding protobuf payloads, zero meaning one per hardware thread (the default)
+    */
+    void setThreadCount(const uint32_t threadCount);
+
+    /**
+        @brief Keep up to _capacity_ decoded payloads for the next payloads with the same bytes, zero (the default)
+        turning the cache off. Changes decoded through it get SingleChange::sharedFields instead of fields, and
+        nothing of it goes into frame arenas. The cache lives across loads until the projection or zero-copy mode
+        changes.
+    */
+    void setDecodeCache(const uint64_t capacity);
+
+    /**
+        @brief The decode cache with its hit and miss counts, nullptr when it's off
+    */
+    const DecodeCache* getDecodeCache() const;
 
 private:
-    void readFrames(std::ifstream& stream);
-    void readMetaType(std::ifstream& stream, const uint64_t size);
-    void loadInMetaAsXML(const fs::path metaPath);
+    struct MetaFiles
+    {
+        std::string beMeta;
+        std::string elMeta;
+    };
+
+    /* Where a frame sits in a mapped recording, found by hopping between frame headers or out of its index */
+    struct FrameLocation
+    {
+        FrameType type{FrameType::UNKNOWN};
+        CompressionType compression{CompressionType::UNKNOWN};
+        uint32_t frameSize{0};
+        /* Offset of the frame data, right past the frame header */
+        uint64_t offset{0};
+        /* Position of the META frame governing this one */
+        uint32_t metaFrame{RecordingIndex::NO_META};
+        /* Span of the change set timestamps, only known once the frame has been read or from the index */
+        bool hasTimeStamps{false};
+        uint64_t minTimeStamp{UINT64_MAX};
+        uint64_t maxTimeStamp{0};
+        /* Known from the index when filtering by object: last change set of the frame holding a change of the
+           object, NO_OBJECT_CHANGES if none does */
+        std::optional<uint32_t> lastObjectChangeSet;
+    };
+
+    static constexpr uint32_t NO_OBJECT_CHANGES{UINT32_MAX};
 
-    ChangeSetDataVec readChangeSetType(std::ifstream& stream, const CompressionType cType, const uint64_t size);
-    ChangeSetDataVec internalReadChangeSetType(std::ifstream& stream, const uint64_t size, const fs::path& tempPath);
+    /* Frame travelling through the read -> inflate -> decode -> emit pipeline */
+    struct PendingFrame
+    {
+        Frame frame;
+        /* Position in reading order, frames get emitted in this order */
+        uint64_t sequence{0};
+        /* Frame bytes as found in the recording, still compressed */
+        std::span<const uint8_t> frameData{};
+        /* Set while building the index, the time span and the objects of the frame's change sets get recorded in
+           there */
+        FrameLocation* location{nullptr};
+        /* Change sets past this one hold nothing wanted, they don't even get walked */
+        uint32_t lastChangeSet{UINT32_MAX};
+        /* Filled by the inflate stage, consumed by the decode stage */
+        std::vector<ByteSpan> payloads{};
+        std::vector<std::string> classNames{};
+    };
+
+    using FrameQueue = utils::BoundedQueue<PendingFrame>;
+
+    /* Frames read but not emitted yet. Bounds what the emit stage has to hold back while restoring reading order. */
+    static constexpr uint32_t MAX_FRAMES_IN_FLIGHT{32};
+
+    /* Default visitor, keeps every frame */
+    class FrameCollector : public Visitor
+    {
+    public:
+        explicit FrameCollector(std::vector<Frame>& output);
+        void onFrame(Frame& frame) override;
+
+    private:
+        std::vector<Frame>& frames;
+    };
+
+    struct Pipeline
+    {
+        Visitor& visitor;
+        FrameQueue toInflate{PIPELINE_QUEUE_SIZE};
+        FrameQueue toDecode{PIPELINE_QUEUE_SIZE};
+        FrameQueue toEmit{PIPELINE_QUEUE_SIZE};
+        std::counting_semaphore<MAX_FRAMES_IN_FLIGHT> inFlight{MAX_FRAMES_IN_FLIGHT};
+        uint64_t nextSequence{0};
+
+        /**
+            @brief Hand _pending_ over to the inflate stage, tagged with its position in reading order
+        */
+        void submit(PendingFrame&& pending);
+    };
+
+    bool readHeader(utils::ByteCursor& cursor);
+
+    /**
+        @brief Locate every frame after the header. _complete_ tells whether the frames ran up to the end of the file.
+    */
+    std::vector<FrameLocation> scanFrames(utils::ByteCursor& cursor, bool& complete);
+
+    /**
+        @brief Feed the frames of _locations_ not flagged in _skipped_ to _pipeline_. With _recordTimeStamps_ the
+        time span of every change set frame gets filled in as it's read.
+    */
+    void readFrames(std::span<const uint8_t> fileBytes,
+        std::vector<FrameLocation>& locations,
+        const std::vector<bool>& skipped,
+        const bool recordTimeStamps,
+        const std::shared_ptr<const void>& owner,
+        Pipeline& pipeline);
+    void readFrames(std::ifstream& stream, Pipeline& pipeline);
+    bool isFrameSupported(const Frame& frame);
 
-    bool decompressGZipChangeSetFrame(std::ifstream& stream, uint64_t size, fs::path outputPath);
+    bool loadIndex(const fs::path& indexPath,
+        const RecordingIndex::RecordingId& recordingId,
+        std::vector<FrameLocation>& locations) const;
+    /**
+        @brief Store the index of the frames at _locations_, along with the object changes recorded meanwhile
+    */
+    void saveIndex(const fs::path& indexPath,
+        const RecordingIndex::RecordingId& recordingId,
+        const std::vector<FrameLocation>& locations);
+
+    /**
+        @brief Add the changes of the frame at _position_ to the objects they belong to, _objectChanges_ holding the
+        name of the changed object along with where the change sits in the frame
+    */
+    void recordObjectChanges(const uint64_t position,
+        const std::vector<std::pair<std::string_view, RecordingIndex::ObjectChange>>& objectChanges);
+
+    bool hasTimeRange() const;
+    bool hasObjectFilter() const;
+    bool hasFrameRange() const;
+    bool isInFrameRange(const uint64_t position) const;
+
+    /**
+        @brief Whether a change set frame starting at _firstTimeStamp_ and followed by one starting at
+        _nextFirstTimeStamp_ may hold change sets in the time range. Unknown timestamps never rule a frame out.
+    */
+    bool isFrameInTimeRange(const std::optional<uint64_t> firstTimeStamp,
+        const std::optional<uint64_t> nextFirstTimeStamp) const;
+
+    /**
+        @brief Flag the frames of _locations_ that can be dropped without changing the result: those out of the
+        frame range, change set frames out of the time range or known not to hold the filtered object and META frames
+        none of the remaining ones need
+    */
+    std::vector<bool> findSkippedFrames(std::span<const uint8_t> fileBytes,
+        const std::vector<FrameLocation>& locations) const;
+
+    /**
+        @brief Timestamp of the first change set in _frameData_, only inflating as much as needed to get it
+    */
+    std::optional<uint64_t> peekFirstTimeStamp(const CompressionType compression,
+        std::span<const uint8_t> frameData) const;
+
+    /**
+        @brief Run _reader_ on the calling thread feeding frames to the inflate, decode and emit stages. Inflate and
+        decode stages run several frames at once. Returns once every frame has been handed to _visitor_, in reading
+        order.
+    */
+    void runPipeline(const std::function<void(Pipeline&)>& reader, Visitor& visitor);
+    void inflateStage(FrameQueue& input, FrameQueue& output);
+    void decodeStage(FrameQueue& input, FrameQueue& output);
+    void emitStage(Pipeline& pipeline);
+    void visitFrame(Visitor& visitor, Frame& frame);
+
+    /**
+        @brief Load the schema of META frame _metaFrame_ (hashing to _metaHash_), from the cache if possible. Returns
+        nullptr on failure. Doesn't touch any state, so different META frames can be loaded concurrently.
+    */
+    std::shared_ptr<const MetaSchema> loadMeta(std::span<const uint8_t> metaFrame, const uint64_t metaHash) const;
+    MetaFiles readMetaType(std::span<const uint8_t> metaFrame) const;
+    std::shared_ptr<const MetaSchema> loadInMetaAsXML(const MetaFiles& metaFiles) const;
+
+    void readChangeSetType(PendingFrame& pending);
+    ChangeSetDataVec internalReadChangeSetType(utils::ByteCursor cursor, PendingFrame& pending);
+    void decodeChangeSets(PendingFrame& pending);
+
+    /**
+        @brief Decode the payloads of _pending_ through the decode cache, only those not found in it get decoded
+    */
+    void decodeCachedChangeSets(PendingFrame& pending, const Projection::Compiled* compiledProjection);
+
+    /**
+        @brief Get the projection compiled against _schema_, compiling it the first time a schema is seen
+    */
+    std::shared_ptr<const Projection::Compiled> getCompiledProjection(const std::shared_ptr<const MetaSchema>& schema);
+
+    bool decompressGZipChangeSetFrame(std::span<const uint8_t> compressed, std::vector<uint8_t>& output);
 
 private:
-    XMLDecoder::XmlResult beXmlResult;
-    XMLDecoder::XmlResult elXmlResult;
+    /* Frames in flight between two stages. Enough to ride over uneven frame sizes without holding much of a big
+       recording in memory. */
+    static constexpr uint64_t PIPELINE_QUEUE_SIZE{8};
+    /* Threads of the inflate stage and of the decode stage each. Decode stage threads only hand payloads over to
+       the decoder's pool, so they keep that many frames going without adding to the decoding threads. */
+    static constexpr uint32_t FRAME_WORKERS{4};
+    /* META frames loaded ahead of the frame being read */
+    static constexpr uint64_t META_LOOKAHEAD{1};
+
+    std::shared_ptr<const MetaSchema> metaSchema;
+    fs::path schemaCacheDir;
     ProtobufDecoder protoDecoder;
+    bool arenaAllocation{false};
+    Projection projection;
+    uint64_t timeFrom{0};
+    uint64_t timeTo{UINT64_MAX};
+    uint64_t frameFirst{0};
+    uint64_t frameLast{UINT64_MAX};
+    bool indexing{true};
+    std::string objectFilter;
+    std::unique_ptr<DecodeCache> decodeCache;
+
+    /* Changes of every object, filled by the inflate workers while building the index. Each name gets stored
+       once however often its object changes. */
+    std::mutex indexedObjectsMutex;
+    RecordingIndex::ObjectMap indexedObjects;
+
+    /* Decode workers share the compiled projections, one per schema still in use */
+    std::mutex projectionMutex;
+    std::vector<std::pair<std::weak_ptr<const MetaSchema>, std::shared_ptr<const Projection::Compiled>>>
+        compiledProjections;
 
 public:
     Header header;
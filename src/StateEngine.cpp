@@ -0,0 +1,732 @@
+#include "StateEngine.hpp"
+
+#include <fstream>
+#include <unistd.h>
+
+#include "Utility.hpp"
+
+namespace hk
+{
+
+namespace
+{
+enum class ValueKind : uint8_t
+{
+    INTEGER,
+    DOUBLE,
+    STRING,
+    STRINGS,
+    INTEGERS,
+    DOUBLES,
+    MAP,
+    MAPS
+};
+
+/* Snapshot layout: the field name table, then every object as its distinguished name, whether it still exists and
+   if so its fields. Fields refer to their name by position in the table, so each distinct name gets stored once. */
+struct SnapshotWriter
+{
+    utils::CacheWriter body;
+    std::vector<const std::string*> names;
+    std::unordered_map<const std::string*, uint32_t> nameIds;
+
+    void putMap(const FieldMap& map)
+    {
+        body.put<uint32_t>(map.size());
+        for (const auto& [name, value] : map)
+        {
+            /* Names are interned by their schema, the same name always comes with the same address */
+            const auto [it, inserted] = nameIds.try_emplace(&name.str(), names.size());
+            if (inserted)
+            {
+                names.emplace_back(&name.str());
+            }
+            body.put<uint32_t>(it->second);
+            putValue(value);
+        }
+    }
+
+    void putValue(const FieldValue& value)
+    {
+        if (const auto* integer = std::get_if<uint64_t>(&value))
+        {
+            body.put<uint8_t>(static_cast<uint8_t>(ValueKind::INTEGER));
+            body.put<uint64_t>(*integer);
+        }
+        else if (const auto* real = std::get_if<double>(&value))
+        {
+            body.put<uint8_t>(static_cast<uint8_t>(ValueKind::DOUBLE));
+            body.put<double>(*real);
+        }
+        else if (std::holds_alternative<std::pmr::string>(value) || std::holds_alternative<std::string_view>(value))
+        {
+            body.put<uint8_t>(static_cast<uint8_t>(ValueKind::STRING));
+            body.putString(GET_STRV(value));
+        }
+        else if (const auto* strings = std::get_if<StringVec>(&value))
+        {
+            body.put<uint8_t>(static_cast<uint8_t>(ValueKind::STRINGS));
+            body.put<uint32_t>(strings->size());
+            for (const auto& str : *strings)
+            {
+                body.putString(str);
+            }
+        }
+        else if (const auto* integers = std::get_if<IntegerVec>(&value))
+        {
+            body.put<uint8_t>(static_cast<uint8_t>(ValueKind::INTEGERS));
+            body.put<uint32_t>(integers->size());
+            for (const uint64_t element : *integers)
+            {
+                body.put<uint64_t>(element);
+            }
+        }
+        else if (const auto* reals = std::get_if<DoubleVec>(&value))
+        {
+            body.put<uint8_t>(static_cast<uint8_t>(ValueKind::DOUBLES));
+            body.put<uint32_t>(reals->size());
+            for (const double element : *reals)
+            {
+                body.put<double>(element);
+            }
+        }
+        else if (const auto* map = std::get_if<FieldMap>(&value))
+        {
+            body.put<uint8_t>(static_cast<uint8_t>(ValueKind::MAP));
+            putMap(*map);
+        }
+        else if (const auto* maps = std::get_if<FieldMapVec>(&value))
+        {
+            body.put<uint8_t>(static_cast<uint8_t>(ValueKind::MAPS));
+            body.put<uint32_t>(maps->size());
+            for (const FieldMap& nested : *maps)
+            {
+                putMap(nested);
+            }
+        }
+    }
+};
+
+/* Restored maps take their names out of the snapshot's name table. Slots just follow the stored order, which is
+   the slot order of the schema the map was decoded with. */
+struct SnapshotReader
+{
+    utils::CacheReader& in;
+    const std::vector<std::string>& names;
+
+    void getMap(FieldMap& map)
+    {
+        const uint32_t count = in.get<uint32_t>();
+        for (uint32_t slot = 0; in.ok && slot < count; slot++)
+        {
+            const uint32_t nameId = in.get<uint32_t>();
+            if (nameId >= names.size())
+            {
+                in.ok = false;
+                return;
+            }
+            getValue(map[FieldName(names[nameId], slot)]);
+        }
+    }
+
+    void getValue(FieldValue& value)
+    {
+        switch (static_cast<ValueKind>(in.get<uint8_t>()))
+        {
+        case ValueKind::INTEGER:
+            value = in.get<uint64_t>();
+            break;
+        case ValueKind::DOUBLE:
+            value = in.get<double>();
+            break;
+        case ValueKind::STRING:
+            value = std::pmr::string(in.getString());
+            break;
+        case ValueKind::STRINGS:
+        {
+            StringVec& strings = value.emplace<StringVec>();
+            const uint32_t count = in.get<uint32_t>();
+            for (uint32_t i = 0; in.ok && i < count; i++)
+            {
+                strings.emplace_back(in.getString());
+            }
+            break;
+        }
+        case ValueKind::INTEGERS:
+        {
+            IntegerVec& integers = value.emplace<IntegerVec>();
+            const uint32_t count = in.get<uint32_t>();
+            for (uint32_t i = 0; in.ok && i < count; i++)
+            {
+                integers.emplace_back(in.get<uint64_t>());
+            }
+            break;
+        }
+        case ValueKind::DOUBLES:
+        {
+            DoubleVec& reals = value.emplace<DoubleVec>();
+            const uint32_t count = in.get<uint32_t>();
+            for (uint32_t i = 0; in.ok && i < count; i++)
+            {
+                reals.emplace_back(in.get<double>());
+            }
+            break;
+        }
+        case ValueKind::MAP:
+            getMap(value.emplace<FieldMap>());
+            break;
+        case ValueKind::MAPS:
+        {
+            FieldMapVec& maps = value.emplace<FieldMapVec>();
+            const uint32_t count = in.get<uint32_t>();
+            for (uint32_t i = 0; in.ok && i < count; i++)
+            {
+                getMap(maps.emplace_back());
+            }
+            break;
+        }
+        default:
+            in.ok = false;
+            break;
+        }
+    }
+};
+
+FieldMap ownMap(const FieldMap& map);
+
+/* Copy of _value_ that outlives the frame it was decoded from: out of any arena and without views into the frame */
+FieldValue ownValue(const FieldValue& value)
+{
+    if (const auto* view = std::get_if<std::string_view>(&value))
+    {
+        return std::pmr::string(*view);
+    }
+    if (const auto* map = std::get_if<FieldMap>(&value))
+    {
+        return ownMap(*map);
+    }
+    if (const auto* maps = std::get_if<FieldMapVec>(&value))
+    {
+        FieldMapVec owned;
+        owned.reserve(maps->size());
+        for (const FieldMap& nested : *maps)
+        {
+            owned.emplace_back(ownMap(nested));
+        }
+        return owned;
+    }
+    /* Copies of pmr containers use the default resource, not the one they were copied from */
+    return value;
+}
+
+FieldMap ownMap(const FieldMap& map)
+{
+    FieldMap owned;
+    for (const auto& [name, value] : map)
+    {
+        owned[name] = ownValue(value);
+    }
+    return owned;
+}
+
+const MetaSchema::FieldDescriptor* findField(const MetaSchema::MessageSchema& message, const std::string& name)
+{
+    for (const MetaSchema::FieldDescriptor& field : message.fields)
+    {
+        if (field.isPresent && field.name == name)
+        {
+            return &field;
+        }
+    }
+    for (const auto& [fieldNumber, field] : message.overflowFields)
+    {
+        if (field.name == name)
+        {
+            return &field;
+        }
+    }
+    return nullptr;
+}
+
+/* Move _fields_ over to the names of _message_. Fields it doesn't describe (anymore) get dropped. */
+FieldMap rebaseFields(FieldMap&& fields, const MetaSchema::MessageSchema& message)
+{
+    FieldMap rebased;
+    for (auto& [name, value] : fields)
+    {
+        const MetaSchema::FieldDescriptor* field = findField(message, name.str());
+        const bool nested = std::holds_alternative<FieldMap>(value) || std::holds_alternative<FieldMapVec>(value);
+        if (!field || nested != (field->nestedStruct != nullptr))
+        {
+            continue;
+        }
+
+        if (auto* map = std::get_if<FieldMap>(&value))
+        {
+            *map = rebaseFields(std::move(*map), *field->nestedStruct);
+        }
+        else if (auto* maps = std::get_if<FieldMapVec>(&value))
+        {
+            for (FieldMap& nestedMap : *maps)
+            {
+                nestedMap = rebaseFields(std::move(nestedMap), *field->nestedStruct);
+            }
+        }
+        rebased[field->name] = std::move(value);
+    }
+    return rebased;
+}
+} // namespace
+
+fs::path StateEngine::getCheckpointPath(const fs::path& recording)
+{
+    fs::path checkpointPath{recording};
+    checkpointPath += ".hkstate";
+    return checkpointPath;
+}
+
+void StateEngine::setCheckpointInterval(const uint64_t changeSets)
+{
+    checkpointInterval = changeSets;
+}
+
+void StateEngine::setCheckpointing(const bool enabled)
+{
+    checkpointing = enabled;
+}
+
+bool StateEngine::loadStateAt(ChangeData& changeData, const fs::path& path, const uint64_t timeMs)
+{
+    reset();
+    checkpoints.clear();
+    checkpointFile.clear();
+
+    uint64_t firstFrame{0};
+    RecordingIndex::RecordingId recordingId;
+    if (checkpointing && RecordingIndex::identify(path, recordingId))
+    {
+        const fs::path checkpointPath = getCheckpointPath(path);
+        if (!loadCheckpoints(checkpointPath, recordingId) &&
+            !buildCheckpoints(changeData, path, checkpointPath, recordingId))
+        {
+            return false;
+        }
+
+        /* Latest checkpoint that nothing past the asked time went into. Timestamps only go up from one checkpoint
+           to the next, the running maximum is kept. */
+        uint64_t closest{0};
+        while (closest < checkpoints.size() && checkpoints[closest].maxTimeStamp <= timeMs)
+        {
+            closest++;
+        }
+
+        if (closest)
+        {
+            /* Starting from the latest full one, every checkpoint only adds what changed to the one before */
+            const uint64_t last = closest - 1;
+            uint64_t first{last};
+            while (first && !checkpoints[first].full)
+            {
+                first--;
+            }
+
+            std::vector<uint8_t> snapshotBuffer;
+            bool restored{true};
+            for (uint64_t index = first; restored && index <= last; index++)
+            {
+                restored = restoreCheckpoint(checkpoints[index], readSnapshot(checkpoints[index], snapshotBuffer));
+            }
+            if (restored)
+            {
+                firstFrame = checkpoints[last].nextFrame;
+            }
+            else
+            {
+                reset();
+            }
+        }
+    }
+
+    /* Only the tail after the checkpoint gets replayed */
+    changeData.setFrameRange(firstFrame, UINT64_MAX);
+    changeData.setTimeRange(0, timeMs);
+    return changeData.loadFromFile(path, *this);
+}
+
+void StateEngine::reset()
+{
+    objects.clear();
+    currentSchema.reset();
+    timeStamp = 0;
+    maxTimeStamp = 0;
+    pendingReset = false;
+    touchedObjects.clear();
+    touchedAll = true;
+}
+
+const StateEngine::ObjectMap& StateEngine::getObjects() const
+{
+    return objects;
+}
+
+uint64_t StateEngine::getTimeStamp() const
+{
+    return timeStamp;
+}
+
+void StateEngine::onChangeSet(const ChangeData::Frame& frame, const ChangeData::ChangeSetData& changeSet)
+{
+    if (pendingReset)
+    {
+        objects.clear();
+        pendingReset = false;
+        touchedAll = true;
+    }
+
+    currentSchema = frame.metaSchema;
+    timeStamp = changeSet.timeStamp;
+    maxTimeStamp = std::max(maxTimeStamp, changeSet.timeStamp);
+    changeSetsSinceCheckpoint++;
+}
+
+void StateEngine::onChange(const ChangeData::ChangeSetData&, const ChangeData::SingleChange& change)
+{
+    if (building && !touchedAll && change.type != ChangeData::ChangeType::UNKNOWN)
+    {
+        touchedObjects.insert(change.name);
+    }
+
+    if (change.type == ChangeData::ChangeType::DELETED)
+    {
+        objects.erase(change.name);
+        return;
+    }
+    if (change.type != ChangeData::ChangeType::CREATE_UPDATE)
+    {
+        return;
+    }
+
+    ManagedObject& object = objects[change.name];
+    const FieldMap& fields = change.getFields();
+    if (fields.empty())
+    {
+        return;
+    }
+
+    /* Slots only order the names of a single schema. Bring what the object holds over to the schema the change
+       was decoded with before merging into it. */
+    if (object.nameOwner != currentSchema)
+    {
+        if (!object.fields.empty())
+        {
+            const MetaSchema::MessageSchema* message = currentSchema->getClass(ChangeData::getClassName(change.name));
+            object.fields = message ? rebaseFields(std::move(object.fields), *message) : FieldMap{};
+        }
+        object.nameOwner = currentSchema;
+    }
+
+    for (const auto& [name, value] : fields)
+    {
+        object.fields[name] = ownValue(value);
+    }
+}
+
+void StateEngine::onReset(const ChangeData::Frame&)
+{
+    pendingReset = true;
+}
+
+void StateEngine::onFrame(ChangeData::Frame& frame)
+{
+    if (building && frame.type == ChangeData::FrameType::CHANGE_SET && changeSetsSinceCheckpoint >= checkpointInterval)
+    {
+        takeCheckpoint(frame.position + 1);
+    }
+}
+
+bool StateEngine::buildCheckpoints(ChangeData& changeData,
+    const fs::path& path,
+    const fs::path& checkpointPath,
+    const RecordingIndex::RecordingId& recordingId)
+{
+    /* Written next to the final file and renamed in place so concurrent readers never see half of it */
+    checkpointTmpPath = checkpointPath.string() + ".tmp" + std::to_string(getpid());
+    checkpointOut.open(checkpointTmpPath, std::ios::binary | std::ios::trunc);
+    if (!checkpointOut)
+    {
+        printlne("Failed to write state checkpoints %s, replaying from the start", checkpointTmpPath.c_str());
+        return true;
+    }
+
+    /* The header goes in once the table is known, only its room gets taken for now */
+    const std::vector<char> headerRoom(CHECKPOINT_HEADER_SIZE);
+    checkpointOut.write(headerRoom.data(), headerRoom.size());
+    snapshotsSize = 0;
+    deltasSinceFull = 0;
+
+    reset();
+    building = true;
+    changeSetsSinceCheckpoint = 0;
+    changeData.setFrameRange(0, UINT64_MAX);
+    changeData.setTimeRange(0, UINT64_MAX);
+    const bool loaded = changeData.loadFromFile(path, *this);
+    building = false;
+    reset();
+
+    if (!loaded || !saveCheckpoints(checkpointPath, recordingId))
+    {
+        checkpointOut.close();
+        std::error_code ec;
+        fs::remove(checkpointTmpPath, ec);
+        checkpoints.clear();
+    }
+    return loaded;
+}
+
+void StateEngine::takeCheckpoint(const uint64_t nextFrame)
+{
+    const bool full = touchedAll || deltasSinceFull + 1 >= FULL_CHECKPOINT_INTERVAL;
+
+    SnapshotWriter writer;
+    const auto putObject = [&writer](const std::string& distName, const ManagedObject* object)
+    {
+        writer.body.putString(distName);
+        writer.body.put<uint8_t>(object != nullptr);
+        if (object)
+        {
+            writer.putMap(object->fields);
+        }
+    };
+    if (full)
+    {
+        writer.body.put<uint64_t>(objects.size());
+        for (const auto& [distName, object] : objects)
+        {
+            putObject(distName, &object);
+        }
+    }
+    else
+    {
+        /* Objects gone since the checkpoint before get stored without their fields */
+        writer.body.put<uint64_t>(touchedObjects.size());
+        for (const std::string& distName : touchedObjects)
+        {
+            const auto it = objects.find(distName);
+            putObject(distName, it != objects.end() ? &it->second : nullptr);
+        }
+    }
+
+    utils::CacheWriter snapshot;
+    snapshot.put<uint32_t>(writer.names.size());
+    for (const std::string* name : writer.names)
+    {
+        snapshot.putString(*name);
+    }
+    snapshot.bytes.insert(snapshot.bytes.end(), writer.body.bytes.begin(), writer.body.bytes.end());
+    checkpointOut.write(reinterpret_cast<const char*>(snapshot.bytes.data()), snapshot.bytes.size());
+
+    checkpoints.push_back({.nextFrame = nextFrame,
+        .maxTimeStamp = maxTimeStamp,
+        .timeStamp = timeStamp,
+        .pendingReset = pendingReset,
+        .full = full,
+        .offset = snapshotsSize,
+        .size = snapshot.bytes.size(),
+        .hash = utils::hashBytes(snapshot.bytes.data(), snapshot.bytes.size())});
+    snapshotsSize += snapshot.bytes.size();
+    deltasSinceFull = full ? 0 : deltasSinceFull + 1;
+    touchedObjects.clear();
+    touchedAll = false;
+    changeSetsSinceCheckpoint = 0;
+}
+
+bool StateEngine::saveCheckpoints(const fs::path& checkpointPath, const RecordingIndex::RecordingId& recordingId)
+{
+    utils::CacheWriter table;
+    for (const Checkpoint& checkpoint : checkpoints)
+    {
+        table.put<uint64_t>(checkpoint.nextFrame);
+        table.put<uint64_t>(checkpoint.maxTimeStamp);
+        table.put<uint64_t>(checkpoint.timeStamp);
+        table.put<uint8_t>(checkpoint.pendingReset);
+        table.put<uint8_t>(checkpoint.full);
+        table.put<uint64_t>(checkpoint.offset);
+        table.put<uint64_t>(checkpoint.size);
+        table.put<uint64_t>(checkpoint.hash);
+    }
+    table.put<uint64_t>(utils::hashBytes(table.bytes.data(), table.bytes.size()));
+
+    utils::CacheWriter header;
+    header.put<uint64_t>(CHECKPOINT_MAGIC);
+    header.put<uint32_t>(CHECKPOINT_FORMAT_VERSION);
+    header.put<uint64_t>(recordingId.size);
+    header.put<int64_t>(recordingId.modifiedTime);
+    header.put<uint64_t>(recordingId.headHash);
+    header.put<uint64_t>(checkpointInterval);
+    header.put<uint32_t>(checkpoints.size());
+    header.put<uint64_t>(CHECKPOINT_HEADER_SIZE + snapshotsSize);
+
+    checkpointOut.write(reinterpret_cast<const char*>(table.bytes.data()), table.bytes.size());
+    checkpointOut.seekp(0);
+    checkpointOut.write(reinterpret_cast<const char*>(header.bytes.data()), header.bytes.size());
+    checkpointOut.close();
+    if (checkpointOut.fail())
+    {
+        printlne("Failed to write state checkpoints %s", checkpointTmpPath.c_str());
+        return false;
+    }
+
+    std::error_code ec;
+    fs::rename(checkpointTmpPath, checkpointPath, ec);
+    if (ec)
+    {
+        printlne("Failed to move state checkpoints %s in place: %s", checkpointPath.c_str(), ec.message().c_str());
+        return false;
+    }
+    checkpointFile = checkpointPath;
+    checkpointHeaderSize = CHECKPOINT_HEADER_SIZE;
+    return true;
+}
+
+bool StateEngine::loadCheckpoints(const fs::path& checkpointPath, const RecordingIndex::RecordingId& recordingId)
+{
+    std::ifstream in{checkpointPath, std::ios::binary};
+    std::error_code ec;
+    const uint64_t fileSize = fs::file_size(checkpointPath, ec);
+    if (in.fail() || ec)
+    {
+        return false;
+    }
+
+    uint8_t fixedPart[CHECKPOINT_HEADER_SIZE];
+    in.read(reinterpret_cast<char*>(fixedPart), sizeof(fixedPart));
+    utils::CacheReader header{.data = fixedPart, .size = sizeof(fixedPart), .ok = !in.fail()};
+    const uint64_t magic = header.get<uint64_t>();
+    const uint32_t formatVersion = header.get<uint32_t>();
+    const RecordingIndex::RecordingId storedId{.size = header.get<uint64_t>(),
+        .modifiedTime = header.get<int64_t>(),
+        .headHash = header.get<uint64_t>()};
+    const uint64_t storedInterval = header.get<uint64_t>();
+    const uint32_t count = header.get<uint32_t>();
+    const uint64_t tableOffset = header.get<uint64_t>();
+    if (!header.ok)
+    {
+        printlne("State checkpoints %s are corrupted, ignoring them", checkpointPath.c_str());
+        return false;
+    }
+    if (magic != CHECKPOINT_MAGIC || formatVersion != CHECKPOINT_FORMAT_VERSION || storedId != recordingId ||
+        storedInterval != checkpointInterval)
+    {
+        printlne("State checkpoints %s are stale, ignoring them", checkpointPath.c_str());
+        return false;
+    }
+
+    /* Only the table gets read and checked here, the snapshots carry their own hash */
+    const uint64_t tableSize = count * CHECKPOINT_ENTRY_SIZE + sizeof(uint64_t);
+    if (tableOffset < sizeof(fixedPart) || tableOffset > fileSize || fileSize - tableOffset != tableSize)
+    {
+        printlne("State checkpoints %s are corrupted, ignoring them", checkpointPath.c_str());
+        return false;
+    }
+    std::vector<uint8_t> table(tableSize);
+    in.seekg(tableOffset);
+    in.read(reinterpret_cast<char*>(table.data()), table.size());
+    utils::CacheReader reader{.data = table.data(), .size = table.size(), .ok = !in.fail()};
+
+    std::vector<Checkpoint> loaded;
+    const uint64_t storedSnapshotsSize = tableOffset - sizeof(fixedPart);
+    for (uint32_t i = 0; reader.ok && i < count; i++)
+    {
+        Checkpoint& checkpoint = loaded.emplace_back();
+        checkpoint.nextFrame = reader.get<uint64_t>();
+        checkpoint.maxTimeStamp = reader.get<uint64_t>();
+        checkpoint.timeStamp = reader.get<uint64_t>();
+        checkpoint.pendingReset = reader.get<uint8_t>();
+        checkpoint.full = reader.get<uint8_t>();
+        checkpoint.offset = reader.get<uint64_t>();
+        checkpoint.size = reader.get<uint64_t>();
+        checkpoint.hash = reader.get<uint64_t>();
+        /* The first one has nothing to build on */
+        if (checkpoint.offset > storedSnapshotsSize || checkpoint.size > storedSnapshotsSize - checkpoint.offset ||
+            (i == 0 && !checkpoint.full))
+        {
+            reader.ok = false;
+        }
+    }
+    const uint64_t tableHash = reader.get<uint64_t>();
+    if (!reader.ok || tableHash != utils::hashBytes(table.data(), tableSize - sizeof(uint64_t)))
+    {
+        printlne("State checkpoints %s are corrupted, ignoring them", checkpointPath.c_str());
+        return false;
+    }
+
+    checkpoints = std::move(loaded);
+    checkpointFile = checkpointPath;
+    checkpointHeaderSize = sizeof(fixedPart);
+    return true;
+}
+
+std::span<const uint8_t> StateEngine::readSnapshot(const Checkpoint& checkpoint, std::vector<uint8_t>& buffer) const
+{
+    std::ifstream in{checkpointFile, std::ios::binary};
+    in.seekg(checkpointHeaderSize + checkpoint.offset);
+    buffer.resize(checkpoint.size);
+    in.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    if (in.fail())
+    {
+        buffer.clear();
+    }
+    return buffer;
+}
+
+bool StateEngine::restoreCheckpoint(const Checkpoint& checkpoint, std::span<const uint8_t> snapshot)
+{
+    if (snapshot.size() != checkpoint.size || utils::hashBytes(snapshot.data(), snapshot.size()) != checkpoint.hash)
+    {
+        printlne("State checkpoint at frame %lu is corrupted, replaying from the start", checkpoint.nextFrame);
+        return false;
+    }
+
+    utils::CacheReader in{.data = snapshot.data(), .size = snapshot.size()};
+    std::shared_ptr<std::vector<std::string>> names = std::make_shared<std::vector<std::string>>();
+    const uint32_t nameCount = in.get<uint32_t>();
+    for (uint32_t i = 0; in.ok && i < nameCount; i++)
+    {
+        names->emplace_back(in.getString());
+    }
+
+    if (checkpoint.full)
+    {
+        objects.clear();
+    }
+
+    /* Names get pointed at from here on, the table must not change anymore */
+    SnapshotReader reader{.in = in, .names = *names};
+    const uint64_t objectCount = in.get<uint64_t>();
+    for (uint64_t i = 0; in.ok && i < objectCount; i++)
+    {
+        std::string distName = in.getString();
+        if (!in.get<uint8_t>())
+        {
+            objects.erase(distName);
+            continue;
+        }
+
+        ManagedObject& object = objects[std::move(distName)];
+        object.nameOwner = names;
+        object.fields = FieldMap{};
+        reader.getMap(object.fields);
+    }
+    if (!in.ok || in.pos != in.size)
+    {
+        printlne("State checkpoint at frame %lu is corrupted, replaying from the start", checkpoint.nextFrame);
+        return false;
+    }
+
+    timeStamp = checkpoint.timeStamp;
+    maxTimeStamp = checkpoint.maxTimeStamp;
+    pendingReset = checkpoint.pendingReset;
+    return true;
+}
+
+} // namespace hk
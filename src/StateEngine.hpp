@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <fstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "CacheFile.hpp"
+#include "RecordingIndex.hpp"
+#include "RedactedDecoder.hpp"
+
+namespace hk
+{
+
+/* State of every managed object, built up by applying the changes as they get visited: CREATE_UPDATE creates the
+   object or overwrites the top level fields the change carries, DELETED removes it and a RESET frame drops
+   everything known so far. Every few change sets the state gets snapshotted into a checkpoint, most of them only
+   holding the objects that changed since the checkpoint before. Checkpoints are kept in a "<recording>.hkstate" file
+   next to the recording, so getting the state at some time only costs restoring the closest checkpoint before it
+   and replaying the change sets after that. */
+class StateEngine : public ChangeData::Visitor
+{
+public:
+    struct ManagedObject
+    {
+        /* What the top level field names point into, the schema the object was last updated with or the name
+           table of the checkpoint it got restored from */
+        std::shared_ptr<const void> nameOwner;
+        FieldMap fields;
+    };
+
+    using ObjectMap = std::unordered_map<std::string, ManagedObject>;
+
+    /**
+        @brief Path of the checkpoints belonging to the recording at _recording_
+    */
+    static fs::path getCheckpointPath(const fs::path& recording);
+
+    /**
+        @brief Snapshot the state every _changeSets_ change sets when building checkpoints
+    */
+    void setCheckpointInterval(const uint64_t changeSets);
+
+    /**
+        @brief Use and keep checkpoints next to the recordings. Turn off when decoding with a projection, the state
+        of a projection isn't the full state checkpoints have to hold. On by default.
+    */
+    void setCheckpointing(const bool enabled);
+
+    /**
+        @brief Build the state the recording at _path_ describes as of _timeMs_ (epoch milliseconds): every change
+        set stamped at or before it applied in recording order. Checkpoints get built on the first call for a
+        recording, which reads the whole recording once. _changeData_ does the decoding, its frame and time range
+        get replaced.
+    */
+    bool loadStateAt(ChangeData& changeData, const fs::path& path, const uint64_t timeMs);
+
+    /**
+        @brief Forget every object
+    */
+    void reset();
+
+    const ObjectMap& getObjects() const;
+
+    /**
+        @brief Timestamp of the last change set applied, 0 if none was
+    */
+    uint64_t getTimeStamp() const;
+
+    void onChangeSet(const ChangeData::Frame& frame, const ChangeData::ChangeSetData& changeSet) override;
+    void onChange(const ChangeData::ChangeSetData& changeSet, const ChangeData::SingleChange& change) override;
+    void onReset(const ChangeData::Frame& frame) override;
+    void onFrame(ChangeData::Frame& frame) override;
+
+private:
+    struct Checkpoint
+    {
+        /* Replay resumes at this frame */
+        uint64_t nextFrame{0};
+        /* Latest change set timestamp applied so far, the checkpoint only holds for times from this one on */
+        uint64_t maxTimeStamp{0};
+        uint64_t timeStamp{0};
+        bool pendingReset{false};
+        /* Holds every object, otherwise only those changed since the checkpoint before */
+        bool full{false};
+        /* Where the snapshot sits in the checkpoint file, past the header */
+        uint64_t offset{0};
+        uint64_t size{0};
+        uint64_t hash{0};
+    };
+
+    /**
+        @brief Read the whole recording at _path_ snapshotting the state as it goes. Snapshots get written out as
+        they are taken, only their table stays in memory until saveCheckpoints puts it in the file. Without a
+        place to write them to, no checkpoints get built and nothing is read.
+    */
+    bool buildCheckpoints(ChangeData& changeData,
+        const fs::path& path,
+        const fs::path& checkpointPath,
+        const RecordingIndex::RecordingId& recordingId);
+    void takeCheckpoint(const uint64_t nextFrame);
+    bool saveCheckpoints(const fs::path& checkpointPath, const RecordingIndex::RecordingId& recordingId);
+
+    /**
+        @brief Load the checkpoint table stored by saveCheckpoints. Snapshots themselves only get read once picked.
+    */
+    bool loadCheckpoints(const fs::path& checkpointPath, const RecordingIndex::RecordingId& recordingId);
+
+    /**
+        @brief Read the snapshot of _checkpoint_ into _buffer_
+    */
+    std::span<const uint8_t> readSnapshot(const Checkpoint& checkpoint, std::vector<uint8_t>& buffer) const;
+
+    /**
+        @brief Apply the snapshot _snapshot_ of _checkpoint_ to the state, which has to be the one of the
+        checkpoint before unless _checkpoint_ is a full one
+    */
+    bool restoreCheckpoint(const Checkpoint& checkpoint, std::span<const uint8_t> snapshot);
+
+private:
+    static constexpr uint64_t CHECKPOINT_MAGIC{0x5345544154534b48}; // "HKSTATES"
+    static constexpr uint32_t CHECKPOINT_FORMAT_VERSION{2};
+    /* Magic, version, recording id, interval, checkpoint count and where the table is. Snapshots follow, the table
+       comes last with one entry per checkpoint since it's only known once every snapshot got written. */
+    static constexpr uint64_t CHECKPOINT_HEADER_SIZE{8 + 4 + 3 * 8 + 8 + 4 + 8};
+    static constexpr uint64_t CHECKPOINT_ENTRY_SIZE{3 * 8 + 2 + 3 * 8};
+    static constexpr uint64_t DEFAULT_CHECKPOINT_INTERVAL{10000};
+    /* Every this many checkpoints one holds the whole state, bounds how many get read to restore one */
+    static constexpr uint64_t FULL_CHECKPOINT_INTERVAL{16};
+
+    ObjectMap objects;
+    std::shared_ptr<const MetaSchema> currentSchema;
+    uint64_t timeStamp{0};
+    uint64_t maxTimeStamp{0};
+    /* A RESET takes effect with the first change set after it, so one past the time asked for never applies */
+    bool pendingReset{false};
+
+    bool checkpointing{true};
+    uint64_t checkpointInterval{DEFAULT_CHECKPOINT_INTERVAL};
+
+    /* Only filled while building checkpoints, or after loading them */
+    bool building{false};
+    uint64_t changeSetsSinceCheckpoint{0};
+    /* Objects changed or deleted since the last checkpoint, everything did after a RESET */
+    std::unordered_set<std::string> touchedObjects;
+    bool touchedAll{true};
+    uint64_t deltasSinceFull{0};
+    std::vector<Checkpoint> checkpoints;
+    /* Snapshots being written, renamed into place by saveCheckpoints */
+    std::ofstream checkpointOut;
+    fs::path checkpointTmpPath;
+    uint64_t snapshotsSize{0};
+    fs::path checkpointFile;
+    uint64_t checkpointHeaderSize{0};
+};
+
+} // namespace hk
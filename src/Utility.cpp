@@ -1,16 +1,18 @@
 #include "Utility.hpp"
+#include <bit>
 #include <cstdint>
 #include <cstdio>
+#include <cstring>
 
 namespace utils
 {
 
-uint8_t peek1(std::ifstream& stream)
+uint8_t peek1(std::istream& stream)
 {
     return stream.peek();
 }
 
-uint8_t read1(std::ifstream& stream)
+uint8_t read1(std::istream& stream)
 {
     uint8_t tmp[1];
     stream.read((char*)tmp, 1);
@@ -18,7 +20,7 @@ uint8_t read1(std::ifstream& stream)
     return tmp[0];
 }
 
-uint16_t read2(std::ifstream& stream)
+uint16_t read2(std::istream& stream)
 {
     uint8_t tmp[2];
     stream.read((char*)tmp, 2);
@@ -26,7 +28,7 @@ uint16_t read2(std::ifstream& stream)
     return (uint16_t)tmp[1] | (uint16_t)tmp[0] << 8;
 }
 
-uint32_t read4(std::ifstream& stream)
+uint32_t read4(std::istream& stream)
 {
     uint8_t tmp[4];
     stream.read((char*)tmp, 4);
@@ -34,7 +36,7 @@ uint32_t read4(std::ifstream& stream)
     return tmp[3] | tmp[2] << 8 | tmp[1] << 16 | tmp[0] << 24;
 }
 
-uint64_t read8(std::ifstream& stream)
+uint64_t read8(std::istream& stream)
 {
     // promote to 64 directly as we will hold in it final result
     uint64_t high = read4(stream);
@@ -43,7 +45,7 @@ uint64_t read8(std::ifstream& stream)
     return high << 32 | low;
 }
 
-std::vector<uint8_t> readBytes(std::ifstream& stream, uint32_t n)
+std::vector<uint8_t> readBytes(std::istream& stream, uint32_t n)
 {
     std::vector<uint8_t> result(n, '\0');
 
@@ -51,7 +53,7 @@ std::vector<uint8_t> readBytes(std::ifstream& stream, uint32_t n)
     return result;
 }
 
-std::string readStringBytes(std::ifstream& stream, uint32_t n)
+std::string readStringBytes(std::istream& stream, uint32_t n)
 {
     std::string result(n, '\0');
 
@@ -59,7 +61,7 @@ std::string readStringBytes(std::ifstream& stream, uint32_t n)
     return result;
 }
 
-bool isMagicNumberNext(std::ifstream& stream)
+bool isMagicNumberNext(std::istream& stream)
 {
     // Magic hex: e91100a843a0412d94b306da
     uint64_t highMagic = utils::read8(stream);
@@ -69,4 +71,37 @@ bool isMagicNumberNext(std::ifstream& stream)
     return highMagic == 0xe91100a843a0412d && lowMagic == 0x94b306da;
 }
 
+uint64_t hashBytes(const uint8_t* data, const uint64_t size, const uint64_t seed)
+{
+    /* Single lane XXH64 style mixing, 8 bytes per round. Good enough to key caches, not meant for security. */
+    constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr uint64_t PRIME_3 = 0x165667B19E3779F9ULL;
+    constexpr uint64_t PRIME_4 = 0x85EBCA77C2B2AE63ULL;
+
+    uint64_t hash = seed + PRIME_1 + size * PRIME_2;
+    uint64_t i{0};
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        std::memcpy(&word, data + i, sizeof(word));
+        hash ^= std::rotl(word * PRIME_2, 31) * PRIME_1;
+        hash = std::rotl(hash, 27) * PRIME_1 + PRIME_4;
+    }
+
+    if (i < size)
+    {
+        uint64_t tail{0};
+        std::memcpy(&tail, data + i, size - i);
+        hash ^= std::rotl(tail * PRIME_2, 31) * PRIME_1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
 } // namespace utils
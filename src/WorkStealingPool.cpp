@@ -0,0 +1,194 @@
+#include "WorkStealingPool.hpp"
+
+#include <algorithm>
+
+namespace hk
+{
+namespace
+{
+/* Which pool (if any) the current thread works for and its index in there */
+thread_local const WorkStealingPool* currentPool{nullptr};
+thread_local int64_t currentWorker{-1};
+} // namespace
+
+WorkStealingPool::WorkStealingPool(const uint32_t threadCount)
+{
+    const uint32_t workerCount = threadCount ? threadCount : std::max(std::thread::hardware_concurrency(), 1u);
+
+    deques.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        deques.emplace_back(std::make_unique<TaskDeque>());
+    }
+
+    /* Deques must all exist before any worker goes looking for something to steal */
+    threads.reserve(workerCount);
+    for (uint32_t i = 0; i < workerCount; i++)
+    {
+        threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::scoped_lock lock{sleepMutex};
+        stop = true;
+    }
+    wakeUp.notify_all();
+
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(TaskGroup& group, std::function<void()> task)
+{
+    group.pending.fetch_add(1);
+
+    const int64_t workerIndex = getCurrentWorker();
+    TaskDeque& target = workerIndex >= 0 ? *deques[workerIndex] : injected;
+    {
+        std::scoped_lock lock{target.mutex};
+        target.tasks.emplace_back(Task{.group = &group, .function = std::move(task)});
+    }
+    queuedTasks.fetch_add(1);
+
+    /* Taking the lock makes sure nobody is between checking for work and going to sleep */
+    {
+        std::scoped_lock lock{sleepMutex};
+    }
+    wakeUp.notify_one();
+}
+
+void WorkStealingPool::wait(TaskGroup& group)
+{
+    const int64_t workerIndex = getCurrentWorker();
+    if (workerIndex < 0)
+    {
+        std::unique_lock lock{sleepMutex};
+        groupDone.wait(lock, [&group]() { return group.pending.load() == 0; });
+        return;
+    }
+
+    while (group.pending.load() > 0)
+    {
+        if (tryRunOne(workerIndex))
+        {
+            continue;
+        }
+
+        /* Nothing to help with, sleep until the group is done or new work shows up */
+        std::unique_lock lock{sleepMutex};
+        wakeUp.wait(lock, [this, &group]() { return group.pending.load() == 0 || queuedTasks.load() > 0; });
+    }
+}
+
+uint32_t WorkStealingPool::getThreadCount() const
+{
+    return threads.size();
+}
+
+void WorkStealingPool::workerLoop(const uint32_t workerIndex)
+{
+    currentPool = this;
+    currentWorker = workerIndex;
+
+    while (true)
+    {
+        if (tryRunOne(workerIndex))
+        {
+            continue;
+        }
+
+        std::unique_lock lock{sleepMutex};
+        wakeUp.wait(lock, [this]() { return stop || queuedTasks.load() > 0; });
+        if (stop && queuedTasks.load() == 0)
+        {
+            return;
+        }
+    }
+}
+
+int64_t WorkStealingPool::getCurrentWorker() const
+{
+    return currentPool == this ? currentWorker : -1;
+}
+
+bool WorkStealingPool::tryRunOne(const int64_t workerIndex)
+{
+    Task task;
+    if (!popTask(workerIndex, task))
+    {
+        return false;
+    }
+
+    task.function();
+
+    /* Last task of the group, wake up whoever waits on it */
+    if (task.group->pending.fetch_sub(1) == 1)
+    {
+        {
+            std::scoped_lock lock{sleepMutex};
+        }
+        wakeUp.notify_all();
+        groupDone.notify_all();
+    }
+    return true;
+}
+
+bool WorkStealingPool::popTask(const int64_t workerIndex, Task& task)
+{
+    const auto takeBack = [this, &task](TaskDeque& from)
+    {
+        std::scoped_lock lock{from.mutex};
+        if (from.tasks.empty())
+        {
+            return false;
+        }
+        task = std::move(from.tasks.back());
+        from.tasks.pop_back();
+        queuedTasks.fetch_sub(1);
+        return true;
+    };
+
+    const auto takeFront = [this, &task](TaskDeque& from)
+    {
+        std::scoped_lock lock{from.mutex};
+        if (from.tasks.empty())
+        {
+            return false;
+        }
+        task = std::move(from.tasks.front());
+        from.tasks.pop_front();
+        queuedTasks.fetch_sub(1);
+        return true;
+    };
+
+    /* Own newest task first, then work coming from outside, then the oldest task of somebody else */
+    if (workerIndex >= 0 && takeBack(*deques[workerIndex]))
+    {
+        return true;
+    }
+
+    if (takeFront(injected))
+    {
+        return true;
+    }
+
+    const uint64_t dequeCount = deques.size();
+    const uint64_t firstVictim = workerIndex >= 0 ? workerIndex + 1 : 0;
+    for (uint64_t i = 0; i < dequeCount; i++)
+    {
+        const uint64_t victim = (firstVictim + i) % dequeCount;
+        if ((int64_t)victim != workerIndex && takeFront(*deques[victim]))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+} // namespace hk
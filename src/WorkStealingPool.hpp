@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hk
+{
+
+/* Fixed set of worker threads, each owning a deque of tasks. A worker runs its own newest task first, which keeps
+   subtasks close to the data their parent just touched, and steals the oldest task of another worker once it runs
+   dry. Workers waiting on a TaskGroup run queued tasks in the meantime, so tasks can spawn subtasks and wait for
+   them without tying up a worker. Threads outside the pool only hand work over and sleep while it runs, so no more
+   than the pool's threads ever run tasks. */
+class WorkStealingPool
+{
+public:
+    /* Tasks submitted together that someone is going to wait on */
+    class TaskGroup
+    {
+    public:
+        TaskGroup() = default;
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+    private:
+        friend class WorkStealingPool;
+        std::atomic<uint64_t> pending{0};
+    };
+
+    /**
+        @brief Start _threadCount_ workers. Zero picks one per hardware thread.
+    */
+    explicit WorkStealingPool(const uint32_t threadCount = 0);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+        @brief Queue _task_ as part of _group_. Tasks submitted by a worker go on that worker's own deque, anything
+        else goes on a shared one.
+    */
+    void submit(TaskGroup& group, std::function<void()> task);
+
+    /**
+        @brief Wait until every task of _group_ is done. Workers of the pool help with queued tasks in the meantime.
+    */
+    void wait(TaskGroup& group);
+
+    uint32_t getThreadCount() const;
+
+private:
+    struct Task
+    {
+        TaskGroup* group{nullptr};
+        std::function<void()> function;
+    };
+
+    struct TaskDeque
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void workerLoop(const uint32_t workerIndex);
+    int64_t getCurrentWorker() const;
+    bool tryRunOne(const int64_t workerIndex);
+    bool popTask(const int64_t workerIndex, Task& task);
+
+private:
+    /* Deques hold a mutex, keep them at a stable address */
+    std::vector<std::unique_ptr<TaskDeque>> deques;
+    /* Tasks submitted from outside the pool */
+    TaskDeque injected;
+    std::vector<std::thread> threads;
+
+    std::atomic<uint64_t> queuedTasks{0};
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    /* Threads outside the pool waiting on a group, kept apart so that they never swallow a wake up meant for a
+       worker */
+    std::condition_variable groupDone;
+    bool stop{false};
+};
+
+} // namespace hk
@@ -1,67 +1,502 @@
+#include <algorithm>
+#include <charconv>
 #include <chrono>
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unistd.h>
 
+#include "ChangeDelta.hpp"
+#include "JsonLinesWriter.hpp"
 #include "RedactedDecoder.hpp"
+#include "StateEngine.hpp"
 #include "Utility.hpp"
 
+class ChangePrinter : public hk::ChangeData::Visitor
+{
+public:
+    void onChangeSet(const hk::ChangeData::Frame&, const hk::ChangeData::ChangeSetData& changeSet) override
+    {
+        std::time_t unix_timestamp = changeSet.timeStamp;
+        std::chrono::milliseconds ms(unix_timestamp);
+        std::chrono::system_clock::time_point tp(ms);
+        std::time_t time = std::chrono::system_clock::to_time_t(tp);
+        std::tm* utc_tm = std::gmtime(&time);
+        std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", utc_tm);
+
+        changeSetCount++;
+    }
+
+    void onChange(const hk::ChangeData::ChangeSetData& changeSet, const hk::ChangeData::SingleChange& change) override
+    {
+        // channels list isnt properly showing
+        println("Frame %ld | Timestamp %s | Changes %ld", changeSetCount, timestamp, changeSet.changes.size());
+        printlne("type: %d name: %s", (uint8_t)change.type, change.name.c_str());
+        hk::ProtobufDecoder::printFields(change.getFields());
+    }
+
+    void onReset(const hk::ChangeData::Frame&) override
+    {
+        println("Reset after %lu change sets", changeSetCount);
+    }
+
+    void onFrame(hk::ChangeData::Frame&) override
+    {
+        frameCount++;
+    }
+
+public:
+    uint64_t frameCount{0};
+    uint64_t changeSetCount{0};
+
+private:
+    char timestamp[100]{};
+};
+
+/* Sits in front of whichever output is used and adds up what the frame arenas allocated */
+class ArenaCounter : public hk::ChangeData::Visitor
+{
+public:
+    explicit ArenaCounter(hk::ChangeData::Visitor& visitor)
+        : output{visitor}
+    {}
+
+    void onHeader(const hk::ChangeData::Header& header) override
+    {
+        output.onHeader(header);
+    }
+
+    void onMeta(const hk::ChangeData::Frame& frame) override
+    {
+        output.onMeta(frame);
+    }
+
+    void onReset(const hk::ChangeData::Frame& frame) override
+    {
+        output.onReset(frame);
+    }
+
+    void onChangeSet(const hk::ChangeData::Frame& frame, const hk::ChangeData::ChangeSetData& changeSet) override
+    {
+        output.onChangeSet(frame, changeSet);
+    }
+
+    void onChange(const hk::ChangeData::ChangeSetData& changeSet, const hk::ChangeData::SingleChange& change) override
+    {
+        output.onChange(changeSet, change);
+    }
+
+    void onFrame(hk::ChangeData::Frame& frame) override
+    {
+        /* Counted before handing the frame over, the output may keep its arena */
+        if (frame.arena)
+        {
+            arenaAllocations += frame.arena->getAllocationCount();
+            arenaBytes += frame.arena->getAllocatedBytes();
+        }
+        output.onFrame(frame);
+    }
+
+public:
+    uint64_t arenaAllocations{0};
+    uint64_t arenaBytes{0};
+
+private:
+    hk::ChangeData::Visitor& output;
+};
+
+namespace
+{
+/* Take the _digits_ digits long number at the front of _value_ */
+bool takeNumber(std::string_view& value, const uint64_t digits, uint32_t& number)
+{
+    if (value.size() < digits)
+    {
+        return false;
+    }
+    const auto [ptr, ec] = std::from_chars(value.data(), value.data() + digits, number);
+    if (ec != std::errc() || ptr != value.data() + digits)
+    {
+        return false;
+    }
+    value.remove_prefix(digits);
+    return true;
+}
+
+bool takeChar(std::string_view& value, const char ch)
+{
+    if (!value.starts_with(ch))
+    {
+        return false;
+    }
+    value.remove_prefix(1);
+    return true;
+}
+
+/* Either epoch milliseconds or an ISO 8601 UTC time: 2023-11-14[T22:14[:16[.250]]][Z] */
+bool parseTime(std::string_view value, uint64_t& timeMs)
+{
+    const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), timeMs);
+    if (ec == std::errc() && ptr == value.data() + value.size())
+    {
+        return true;
+    }
+
+    uint32_t year{0};
+    uint32_t month{0};
+    uint32_t day{0};
+    uint32_t hour{0};
+    uint32_t minute{0};
+    uint32_t second{0};
+    uint32_t millisecond{0};
+    if (!takeNumber(value, 4, year) || !takeChar(value, '-') || !takeNumber(value, 2, month) ||
+        !takeChar(value, '-') || !takeNumber(value, 2, day))
+    {
+        return false;
+    }
+    if (takeChar(value, 'T') || takeChar(value, ' '))
+    {
+        if (!takeNumber(value, 2, hour) || !takeChar(value, ':') || !takeNumber(value, 2, minute))
+        {
+            return false;
+        }
+        if (takeChar(value, ':') && !takeNumber(value, 2, second))
+        {
+            return false;
+        }
+        if (takeChar(value, '.') && !takeNumber(value, 3, millisecond))
+        {
+            return false;
+        }
+    }
+    takeChar(value, 'Z');
+
+    const std::chrono::year_month_day date{std::chrono::year(year), std::chrono::month(month), std::chrono::day(day)};
+    if (!value.empty() || !date.ok() || year < 1970 || hour > 23 || minute > 59 || second > 59)
+    {
+        return false;
+    }
+
+    const std::chrono::sys_time<std::chrono::milliseconds> time = std::chrono::sys_days{date} +
+                                                                  std::chrono::hours(hour) +
+                                                                  std::chrono::minutes(minute) +
+                                                                  std::chrono::seconds(second) +
+                                                                  std::chrono::milliseconds(millisecond);
+    timeMs = time.time_since_epoch().count();
+    return true;
+}
+
+/* Single frame position or an inclusive range of them: 12 or 12-40 */
+bool parseFrameRange(const std::string_view value, uint64_t& first, uint64_t& last)
+{
+    const char* end = value.data() + value.size();
+    const auto [firstEnd, firstEc] = std::from_chars(value.data(), end, first);
+    if (firstEc != std::errc())
+    {
+        return false;
+    }
+    if (firstEnd == end)
+    {
+        last = first;
+        return true;
+    }
+    if (*firstEnd != '-')
+    {
+        return false;
+    }
+    const auto [lastEnd, lastEc] = std::from_chars(firstEnd + 1, end, last);
+    return lastEc == std::errc() && lastEnd == end && first <= last;
+}
+
+void printDecodeCacheStats(const hk::ChangeData& changeData)
+{
+    if (const hk::DecodeCache* decodeCache = changeData.getDecodeCache())
+    {
+        println("Decode cache: %lu hits, %lu misses", decodeCache->getHits(), decodeCache->getMisses());
+    }
+}
+} // namespace
+
 int main(int argc, char** argv)
 {
-    if (argc < 2)
+    const char* filePath{nullptr};
+    bool zeroCopy{false};
+    bool arena{false};
+    uint32_t threadCount{0};
+    hk::Projection projection;
+    uint64_t timeFrom{0};
+    uint64_t timeTo{UINT64_MAX};
+    uint64_t frameFirst{0};
+    uint64_t frameLast{UINT64_MAX};
+    bool indexing{true};
+    std::string distName;
+    std::optional<uint64_t> stateAt;
+    uint64_t checkpointInterval{0};
+    bool delta{false};
+    uint64_t decodeCacheSize{0};
+    bool jsonLines{false};
+    for (int32_t i = 1; i < argc; i++)
     {
-        printlne("Incorrect number of arguments: %d", argc);
-        printlne("Usage %s <file_path>", argv[0]);
-        return 1;
+        const std::string_view arg{argv[i]};
+        if (arg == "--zero-copy")
+        {
+            zeroCopy = true;
+        }
+        else if (arg == "--arena")
+        {
+            arena = true;
+        }
+        else if (arg == "--threads" && i + 1 < argc)
+        {
+            const std::string_view value{argv[++i]};
+            const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), threadCount);
+            if (ec != std::errc() || ptr != value.data() + value.size())
+            {
+                printlne("Invalid thread count: %s", argv[i]);
+                filePath = nullptr;
+                break;
+            }
+        }
+        else if (arg == "--project" && i + 1 < argc)
+        {
+            /* Either the spec itself or @ followed by the file holding it */
+            const std::string_view value{argv[++i]};
+            const bool loaded = value.starts_with('@') ? projection.loadFromFile(value.substr(1))
+                                                       : projection.parse(std::string(value));
+            if (!loaded)
+            {
+                printlne("Invalid projection: %s", argv[i]);
+                filePath = nullptr;
+                break;
+            }
+        }
+        else if ((arg == "--from" || arg == "--to") && i + 1 < argc)
+        {
+            if (!parseTime(argv[++i], arg == "--from" ? timeFrom : timeTo))
+            {
+                printlne("Invalid time: %s", argv[i]);
+                filePath = nullptr;
+                break;
+            }
+        }
+        else if (arg == "--frames" && i + 1 < argc)
+        {
+            if (!parseFrameRange(argv[++i], frameFirst, frameLast))
+            {
+                printlne("Invalid frame range: %s", argv[i]);
+                filePath = nullptr;
+                break;
+            }
+        }
+        else if (arg == "--object" && i + 1 < argc)
+        {
+            distName = argv[++i];
+        }
+        else if (arg == "--delta")
+        {
+            delta = true;
+        }
+        else if (arg == "--decode-cache" && i + 1 < argc)
+        {
+            const std::string_view value{argv[++i]};
+            const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), decodeCacheSize);
+            if (ec != std::errc() || ptr != value.data() + value.size())
+            {
+                printlne("Invalid decode cache size: %s", argv[i]);
+                filePath = nullptr;
+                break;
+            }
+        }
+        else if (arg.starts_with("--format=") || (arg == "--format" && i + 1 < argc))
+        {
+            const std::string_view value{arg == "--format" ? std::string_view{argv[++i]} : arg.substr(9)};
+            if (value != "text" && value != "jsonl")
+            {
+                printlne("Invalid format: %.*s", static_cast<int32_t>(value.size()), value.data());
+                filePath = nullptr;
+                break;
+            }
+            jsonLines = value == "jsonl";
+        }
+        else if (arg == "--no-index")
+        {
+            indexing = false;
+        }
+        else if (arg == "--state-at" && i + 1 < argc)
+        {
+            if (!parseTime(argv[++i], stateAt.emplace()))
+            {
+                printlne("Invalid time: %s", argv[i]);
+                filePath = nullptr;
+                break;
+            }
+        }
+        else if (arg == "--checkpoint-every" && i + 1 < argc)
+        {
+            const std::string_view value{argv[++i]};
+            const auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), checkpointInterval);
+            if (ec != std::errc() || ptr != value.data() + value.size() || checkpointInterval == 0)
+            {
+                printlne("Invalid checkpoint interval: %s", argv[i]);
+                filePath = nullptr;
+                break;
+            }
+        }
+        else if (arg.starts_with("--") || filePath)
+        {
+            printlne("Unexpected argument: %s", argv[i]);
+            filePath = nullptr;
+            break;
+        }
+        else
+        {
+            filePath = argv[i];
+        }
     }
 
-    std::ifstream modelPath{argv[1], std::ios::binary};
+    if (timeFrom > timeTo)
+    {
+        printlne("--from is past --to");
+        filePath = nullptr;
+    }
 
-    if (modelPath.fail())
+    /* The state at some time is made out of everything before it, it picks frames and times on its own */
+    if (stateAt && (timeFrom != 0 || timeTo != UINT64_MAX || frameFirst != 0 || frameLast != UINT64_MAX))
     {
-        printlne("Failed to find/open: %s", argv[1]);
+        printlne("--state-at can't be combined with --from, --to or --frames");
+        filePath = nullptr;
+    }
+
+    if (stateAt && (delta || jsonLines))
+    {
+        printlne("--state-at can't be combined with --delta or --format jsonl");
+        filePath = nullptr;
+    }
+
+    if (!filePath)
+    {
+        printlne("Incorrect arguments");
+        printlne("Usage %s [--zero-copy] [--arena] [--threads <count>] [--project <spec|@file>] [--from <time>] "
+                 "[--to <time>] [--frames <first>[-<last>]] [--object <dist_name>] [--delta] [--decode-cache <entries>] "
+                 "[--format <text|jsonl>] [--no-index] [--state-at <time> [--checkpoint-every <changesets>]] <file_path>",
+            argv[0]);
         return 1;
     }
 
     /* Read in all the changes */
     hk::ChangeData changesData;
-    changesData.loadFromPath(modelPath);
+    changesData.setZeroCopy(zeroCopy);
+    changesData.setArenaAllocation(arena);
+    changesData.setProjection(projection);
+    changesData.setTimeRange(timeFrom, timeTo);
+    changesData.setFrameRange(frameFirst, frameLast);
+    changesData.setIndexing(indexing);
+    changesData.setObjectFilter(distName);
+    changesData.setDecodeCache(decodeCacheSize);
+    if (threadCount)
+    {
+        changesData.setThreadCount(threadCount);
+    }
 
-    for (uint64_t frameId{0}; const auto& frame : changesData.frames)
+    if (stateAt)
     {
-        for (const auto& changeSet : frame.changeSetData)
+        hk::StateEngine stateEngine;
+        stateEngine.setCheckpointing(indexing && projection.empty() && distName.empty());
+        if (checkpointInterval)
+        {
+            stateEngine.setCheckpointInterval(checkpointInterval);
+        }
+        if (!stateEngine.loadStateAt(changesData, filePath, *stateAt))
         {
-            std::time_t unix_timestamp = changeSet.timeStamp;
-            std::chrono::milliseconds ms(unix_timestamp);
-            std::chrono::system_clock::time_point tp(ms);
-            std::time_t time = std::chrono::system_clock::to_time_t(tp);
-            auto milliseconds_part = ms.count() % 1000;
-            std::tm* utc_tm = std::gmtime(&time);
-            char buffer[100];
-            std::strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", utc_tm);
+            printlne("Failed to find/open: %s", filePath);
+            return 1;
+        }
 
-            frameId++;
+        /* Sorted so that the same state always prints the same */
+        std::vector<const hk::StateEngine::ObjectMap::value_type*> objects;
+        objects.reserve(stateEngine.getObjects().size());
+        for (const auto& object : stateEngine.getObjects())
+        {
+            objects.emplace_back(&object);
+        }
+        std::sort(objects.begin(), objects.end(), [](const auto* a, const auto* b) { return a->first < b->first; });
+        for (const auto* object : objects)
+        {
+            println("Object %s", object->first.c_str());
+            hk::ProtobufDecoder::printFields(object->second.fields, 1);
+        }
 
-            for (const auto& change : changeSet.changes)
+        println("Version %d", changesData.header.version);
+        println("Additional info is: %s", changesData.header.additionalInfo.c_str());
+        println("Objects: %lu", objects.size());
+        printDecodeCacheStats(changesData);
+        return 0;
+    }
+
+    /* Print changes as they get decoded instead of keeping the whole recording around */
+    ChangePrinter printer;
+    std::optional<hk::JsonLinesWriter> jsonWriter;
+    hk::ChangeData::Visitor* output = &printer;
+    int32_t jsonFd{-1};
+    if (jsonLines)
+    {
+        /* JSON lines get stdout to themselves, log lines go to stderr instead */
+        fflush(stdout);
+        jsonFd = dup(STDOUT_FILENO);
+        if (jsonFd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+        {
+            printlne("Failed to set up JSON lines output");
+            if (jsonFd >= 0)
             {
-                // channels list isnt properly showing
-                println("Frame %ld | Timestamp %s | Changes %ld", frameId, buffer, changeSet.changes.size());
-                printlne("type: %d name: %s", (uint8_t)change.type, change.name.c_str());
-                hk::ProtobufDecoder::printFields(change.fields);
+                close(jsonFd);
             }
+            return 1;
         }
+        output = &jsonWriter.emplace(jsonFd);
     }
+    hk::ChangeDelta changeDelta{*output};
+    ArenaCounter arenaCounter{delta ? changeDelta : *output};
+    const bool loaded = changesData.loadFromFile(filePath, arenaCounter);
 
-    uint32_t changesInAllFrames{0};
-
-    for (const auto& frame : changesData.frames)
+    /* Every line is out once finish returns, the duplicated stdout isn't needed past that */
+    const bool written = !jsonWriter || jsonWriter->finish();
+    if (jsonFd >= 0)
+    {
+        close(jsonFd);
+    }
+    if (!loaded)
+    {
+        printlne("Failed to load: %s", filePath);
+        return 1;
+    }
+    if (!written)
     {
-        changesInAllFrames += frame.changeSetData.size();
+        return 1;
     }
+
     println("Version %d", changesData.header.version);
     println("Additional info is: %s", changesData.header.additionalInfo.c_str());
-    println("Frames: %ld", changesData.frames.size());
-    println("ChangeSets: %d", changesInAllFrames);
+    if (jsonWriter)
+    {
+        println("Lines: %lu", jsonWriter->getLineCount());
+    }
+    else
+    {
+        println("Frames: %ld", printer.frameCount);
+        println("ChangeSets: %lu", printer.changeSetCount);
+    }
+    if (arena)
+    {
+        println("Arena allocations: %lu (%lu bytes)", arenaCounter.arenaAllocations, arenaCounter.arenaBytes);
+    }
+    if (delta)
+    {
+        println("Repeated payloads: %lu", changeDelta.getRepeatedPayloads());
+    }
+    printDecodeCacheStats(changesData);
 
     return 0;
 }
\ No newline at end of file